@@ -35,6 +35,59 @@ namespace fastGHQuad {
     }
     return fun(n, x, w);
   }
+
+  // Maps for the Gauss-Hermite filter: evaluate a function at m points x
+  // (m x dIn, column-major) for time index t, writing m x dOut to out.
+  typedef void (*ghfMap)(int t, int m, int dIn, const double *x, int dOut,
+                         double *out, void *data);
+
+  int ghKalmanFilter(int nTime, int dState, int dObs, const double *y,
+                     const double *m0, const double *P0, const double *Q,
+                     const double *R, const std::vector<double> &x,
+                     const std::vector<double> &w, ghfMap transition,
+                     void *fData, ghfMap measurement, void *hData,
+                     double *mPred, double *PPred, double *mFilt,
+                     double *PFilt, double *logLik) {
+    typedef int (*Fun)(int, int, int, const double *, const double *,
+                       const double *, const double *, const double *,
+                       const std::vector<double> &,
+                       const std::vector<double> &, ghfMap, void *, ghfMap,
+                       void *, double *, double *, double *, double *,
+                       double *);
+    static Fun fun = NULL;
+    if (fun == NULL) {
+      Rf_eval(Rf_lang2(Rf_install("loadNamespace"),
+                       Rf_ScalarString(Rf_mkChar("fastGHQuad"))),
+                       R_GlobalEnv);
+      fun = (Fun) R_GetCCallable("fastGHQuad", "ghKalmanFilter");
+    }
+    return fun(nTime, dState, dObs, y, m0, P0, Q, R, x, w, transition, fData,
+               measurement, hData, mPred, PPred, mFilt, PFilt, logLik);
+  }
+
+  // Native log-likelihood kernel for familyAghQuad: writes to out[i] the
+  // log-likelihood of row obs[i] of the nObs x yDim (column-major) response
+  // y at linear predictor eta[i], i < m, given nParam family parameters,
+  // including terms constant in eta. Kernels may run on several threads &
+  // must not call into R.
+  typedef void (*ghqFamilyLogLik)(int m, const double *eta, const int *obs,
+                                  const double *y, int nObs,
+                                  const double *param, double *out);
+
+  // Register a family under name (typically from R_init_<pkg>); returns its
+  // id, or -1 for an invalid descriptor. Re-registering a name replaces it.
+  int registerGhqFamily(const char *name, int yDim, int nParam,
+                        ghqFamilyLogLik logLik) {
+    typedef int (*Fun)(const char *, int, int, ghqFamilyLogLik);
+    static Fun fun = NULL;
+    if (fun == NULL) {
+      Rf_eval(Rf_lang2(Rf_install("loadNamespace"),
+                       Rf_ScalarString(Rf_mkChar("fastGHQuad"))),
+                       R_GlobalEnv);
+      fun = (Fun) R_GetCCallable("fastGHQuad", "registerGhqFamily");
+    }
+    return fun(name, yDim, nParam, logLik);
+  }
   
 }
   
@@ -0,0 +1,1451 @@
+#include "lib.h"
+#include <float.h>
+#include <limits.h>
+#include <algorithm>
+
+using std::vector;
+
+double logSumExp(int n, const double *x) {
+  //
+  // Compute log(sum(exp(x))) without overflow or underflow by factoring out
+  // the largest term.
+  //
+  int i;
+  double xMax = R_NegInf;
+  for (i = 0; i < n; i++) {
+    if (x[i] > xMax) xMax = x[i];
+  }
+  if (!R_FINITE(xMax)) {
+    return xMax;
+  }
+
+  double s = 0.;
+  for (i = 0; i < n; i++) {
+    s += exp(x[i] - xMax);
+  }
+  return xMax + log(s);
+}
+
+void aghqLogMoments(int n, const double *logTerm, const double *z, double mu,
+                    double *logSum, double *mean, double *var) {
+  //
+  // Summarise one adaptive quadrature from its log-scale terms
+  //      logTerm_i = log(w_i) + x_i^2 + log g(z_i)
+  //
+  // On exit, logSum contains log(sum(exp(logTerm))) and mean & var contain
+  // the mean & variance of z under the normalized weights exp(logTerm -
+  // logSum). These are the posterior moments used to re-centre the nodes.
+  //
+  // Moments are accumulated about mu (the current centre) for stability.
+  //
+  *logSum = logSumExp(n, logTerm);
+  if (!R_FINITE(*logSum)) {
+    *mean = mu;
+    *var = R_NaN;
+    return;
+  }
+
+  int i;
+  double p, d, s1 = 0., s2 = 0.;
+  for (i = 0; i < n; i++) {
+    p = exp(logTerm[i] - *logSum);
+    d = z[i] - mu;
+    s1 += p * d;
+    s2 += p * d * d;
+  }
+  *mean = mu + s1;
+  *var = s2 - s1 * s1;
+}
+
+int nestedAghQuad(int nClusters, int nUnits, const int *group,
+                  const vector<double> &xOuter, const vector<double> &wOuter,
+                  const vector<double> &xInner, const vector<double> &wInner,
+                  ghqNestedLogIntegrand logInner, void *innerData,
+                  ghqLogDensity logOuter, void *outerData, int nAdapt,
+                  double *mu, double *sigma, const double *muInner,
+                  const double *sigmaInner, double *logInt) {
+  //
+  // Nested adaptive Gauss-Hermite quadrature for three-level models.
+  //
+  // For each cluster s (e.g. school), computes
+  //
+  //      log L_s = log \int p_s(u) \prod_{j: group_j = s}
+  //                            \int h_j(u, v) dv du
+  //
+  // where logOuter gives log p_s(u) and logInner gives log h_j(u, v) for
+  // unit j (e.g. class). Both callbacks are vectorized; every call covers a
+  // whole level at once, so logInner sees nUnits * nOuter * nInner points per
+  // call and is called (nAdapt+1)^2 times in total.
+  //
+  // Adaptation follows Naylor & Smith (1982) and Rabe-Hesketh et al. (2005):
+  // nodes at each level are re-centred and re-scaled at the posterior mean &
+  // standard deviation computed from the previous pass. Inner integrals are
+  // adapted separately at every outer node, warm-started from the previous
+  // outer pass. All accumulation is on the log scale.
+  //
+  // On entry, mu & sigma (length nClusters) hold starting values for the
+  // outer centring and muInner & sigmaInner (length nUnits) those for the
+  // inner centring; on exit, mu & sigma hold the adapted outer values and
+  // logInt (length nClusters) the log-integrals.
+  //
+  // Returns 0 on success, 1 if a unit's group is out of range.
+  //
+  int nOuter = xOuter.size(), nInner = xInner.size();
+  int nProb = nUnits * nOuter, nPt = nProb * nInner;
+  int i, j, k, l, s, p, it, itInner;
+
+  for (j = 0; j < nUnits; j++) {
+    if (group[j] < 0 || group[j] >= nClusters) return 1;
+  }
+
+  // Log-weights for adaptive quadrature, log(w) + x^2, at each level
+  vector<double> logWStarOuter(nOuter), logWStarInner(nInner);
+  for (k = 0; k < nOuter; k++) {
+    logWStarOuter[k] = log(wOuter[k]) + xOuter[k] * xOuter[k];
+  }
+  for (l = 0; l < nInner; l++) {
+    logWStarInner[l] = log(wInner[l]) + xInner[l] * xInner[l];
+  }
+
+  // Workspace for one pass over all inner points
+  vector<double> uPt(nPt), vPt(nPt), fPt(nPt);
+  vector<int> unitPt(nPt);
+  for (j = 0; j < nUnits; j++) {
+    for (i = j * nOuter * nInner; i < (j + 1) * nOuter * nInner; i++) {
+      unitPt[i] = j;
+    }
+  }
+
+  // Inner centring for problem p = j * nOuter + k (unit j at outer node k)
+  vector<double> muJK(nProb), sdJK(nProb), logIJK(nProb), term(nInner);
+  for (j = 0; j < nUnits; j++) {
+    for (k = 0; k < nOuter; k++) {
+      muJK[j * nOuter + k] = muInner[j];
+      sdJK[j * nOuter + k] = sigmaInner[j];
+    }
+  }
+
+  // Outer nodes & log-integrands, indexed s * nOuter + k
+  vector<double> uNode(nClusters * nOuter), logG(nClusters * nOuter);
+  vector<int> clusterNode(nClusters * nOuter);
+  for (s = 0; s < nClusters; s++) {
+    for (k = 0; k < nOuter; k++) {
+      clusterNode[s * nOuter + k] = s;
+    }
+  }
+
+  vector<double> termOuter(nOuter);
+  double mean, var, logSum;
+  for (it = 0; it <= nAdapt; it++) {
+    // Place outer nodes
+    for (s = 0; s < nClusters; s++) {
+      for (k = 0; k < nOuter; k++) {
+        uNode[s * nOuter + k] = mu[s] + M_SQRT2 * sigma[s] * xOuter[k];
+      }
+    }
+
+    // Adapt & evaluate inner integrals at every outer node in one batch
+    for (itInner = 0; itInner <= nAdapt; itInner++) {
+      for (p = 0; p < nProb; p++) {
+        j = p / nOuter;
+        k = p % nOuter;
+        for (l = 0; l < nInner; l++) {
+          i = p * nInner + l;
+          uPt[i] = uNode[group[j] * nOuter + k];
+          vPt[i] = muJK[p] + M_SQRT2 * sdJK[p] * xInner[l];
+        }
+      }
+      logInner(nPt, &unitPt[0], &uPt[0], &vPt[0], &fPt[0], innerData);
+
+      for (p = 0; p < nProb; p++) {
+        for (l = 0; l < nInner; l++) {
+          term[l] = logWStarInner[l] + fPt[p * nInner + l];
+        }
+        aghqLogMoments(nInner, &term[0], &vPt[p * nInner], muJK[p], &logSum,
+                       &mean, &var);
+        logIJK[p] = logSum + log(M_SQRT2 * sdJK[p]);
+
+        // Re-centre for the next pass, keeping the previous centring if the
+        // posterior moments are degenerate
+        if (itInner < nAdapt && R_FINITE(logSum) && var > 0. &&
+            R_FINITE(var)) {
+          muJK[p] = mean;
+          sdJK[p] = sqrt(var);
+        }
+      }
+    }
+
+    // Combine inner integrals with the outer density at each outer node
+    logOuter(nClusters * nOuter, &clusterNode[0], &uNode[0], &logG[0],
+             outerData);
+    for (j = 0; j < nUnits; j++) {
+      for (k = 0; k < nOuter; k++) {
+        logG[group[j] * nOuter + k] += logIJK[j * nOuter + k];
+      }
+    }
+
+    // Outer quadrature for each cluster
+    for (s = 0; s < nClusters; s++) {
+      for (k = 0; k < nOuter; k++) {
+        termOuter[k] = logWStarOuter[k] + logG[s * nOuter + k];
+      }
+      aghqLogMoments(nOuter, &termOuter[0], &uNode[s * nOuter], mu[s],
+                     &logSum, &mean, &var);
+      logInt[s] = logSum + log(M_SQRT2 * sigma[s]);
+
+      if (it < nAdapt && R_FINITE(logSum) && var > 0. && R_FINITE(var)) {
+        mu[s] = mean;
+        sigma[s] = sqrt(var);
+      }
+    }
+  }
+
+  return 0;
+}
+
+void hermiteGrid(int d, const vector<double> &x, const vector<double> &w,
+                 vector<double> *nodes, vector<double> *logW) {
+  //
+  // Build the d-dimensional tensor-product grid from the one-dimensional
+  // Gauss-Hermite rule (x, w) of order n.
+  //
+  // On exit, nodes (n^d x d, column-major) contains the grid points and logW
+  // (length n^d) the log product weights for adaptive quadrature,
+  //      sum_k log(w_{i_k}) + x_{i_k}^2
+  //
+  // The first coordinate varies fastest.
+  //
+  int n = x.size(), nPts = 1;
+  int i, k, stride;
+  for (k = 0; k < d; k++) nPts *= n;
+
+  nodes->resize(nPts * d);
+  logW->assign(nPts, 0.);
+
+  vector<double> logWStar(n);
+  for (i = 0; i < n; i++) {
+    logWStar[i] = log(w[i]) + x[i] * x[i];
+  }
+
+  for (k = 0, stride = 1; k < d; k++, stride *= n) {
+    for (i = 0; i < nPts; i++) {
+      (*nodes)[i + k * nPts] = x[(i / stride) % n];
+      (*logW)[i] += logWStar[(i / stride) % n];
+    }
+  }
+}
+
+int factorAghQuad(int d, int nBlocks, const int *block,
+                  const vector<vector<double> > &x,
+                  const vector<vector<double> > &w, const double *mu,
+                  const double *sigma, int symmetric, ghqBlockLogIntegrand logG,
+                  void *data, double *logInt) {
+  //
+  // Adaptive Gauss-Hermite quadrature for integrands that factorize over
+  // independent blocks of coordinates,
+  //
+  //      g(z) = \prod_b g_b(z_b)
+  //
+  // so that \int g(z) dz = \prod_b \int g_b(z_b) dz_b. Each block b of
+  // dimension d_b is integrated with the tensor grid of its own rule
+  // (x[b], w[b]), for a total of sum_b n_b^{d_b} evaluations rather than
+  // n^d.
+  //
+  // block (length d) gives the 0-based block of each coordinate. Nodes for
+  // block b are placed at mu_b + sqrt(2) L_b x, where L_b is the Cholesky
+  // factor of the block's sub-matrix of sigma (d x d, column-major; entries
+  // between blocks are ignored).
+  //
+  // If symmetric is nonzero, each g_b must satisfy g_b(mu_b + t) =
+  // g_b(mu_b - t). Only nodes whose first grid coordinate is non-negative
+  // are then evaluated, with the weights of their mirror images folded in,
+  // which roughly halves the number of evaluations.
+  //
+  // logG is called once per block with all of that block's nodes. On exit,
+  // logInt (length nBlocks) contains the log-integral for each block.
+  //
+  // Returns 0 on success, 1 if block is out of range or a block is empty,
+  // and 2 if a block's scale matrix is not positive definite.
+  //
+  int b, i, j, k, m, db, nPts, info;
+  char uplo = 'L';
+
+  for (j = 0; j < d; j++) {
+    if (block[j] < 0 || block[j] >= nBlocks) return 1;
+  }
+
+  vector<int> idx, keep;
+  vector<double> L, grid, logW, z, f, xHalf, wHalf, folded;
+  for (b = 0; b < nBlocks; b++) {
+    // Coordinates in this block
+    idx.clear();
+    for (j = 0; j < d; j++) {
+      if (block[j] == b) idx.push_back(j);
+    }
+    db = idx.size();
+    if (db == 0) return 1;
+
+    // Cholesky factor of block scale matrix
+    L.assign(db * db, 0.);
+    for (j = 0; j < db; j++) {
+      for (i = j; i < db; i++) {
+        L[i + j * db] = sigma[idx[i] + idx[j] * d];
+      }
+    }
+    F77_CALL(dpotrf)(&uplo, &db, &L[0], &db, &info FCONE);
+    if (info != 0) return 2;
+
+    hermiteGrid(db, x[b], w[b], &grid, &logW);
+    nPts = logW.size();
+
+    // Fold grid onto first coordinate >= 0 for symmetric integrands; the
+    // first coordinate varies fastest, so its node is index m % n
+    if (symmetric) {
+      int n = x[b].size();
+      int centre = foldSymmetricRule(x[b], w[b], &xHalf, &wHalf);
+      keep.clear();
+      for (m = 0; m < nPts; m++) {
+        i = m % n;
+        if (i == centre || x[b][i] > 0.) keep.push_back(m);
+      }
+
+      int nKeep = keep.size();
+      folded.resize(nKeep * db);
+      for (k = 0; k < db; k++) {
+        for (m = 0; m < nKeep; m++) {
+          folded[m + k * nKeep] = grid[keep[m] + k * nPts];
+        }
+      }
+      for (m = 0; m < nKeep; m++) {
+        i = keep[m] % n;
+        logW[m] = logW[keep[m]] + (i == centre ? 0. : M_LN2);
+        if (i == centre) folded[m] = 0.;
+      }
+      grid.swap(folded);
+      logW.resize(nKeep);
+      nPts = nKeep;
+    }
+
+    // Transform grid: z = mu + sqrt(2) L x
+    z.resize(nPts * db);
+    for (i = 0; i < db; i++) {
+      for (m = 0; m < nPts; m++) {
+        z[m + i * nPts] = mu[idx[i]];
+      }
+      for (k = 0; k <= i; k++) {
+        for (m = 0; m < nPts; m++) {
+          z[m + i * nPts] += M_SQRT2 * L[i + k * db] * grid[m + k * nPts];
+        }
+      }
+    }
+
+    f.resize(nPts);
+    logG(b, nPts, db, &z[0], &f[0], data);
+    for (m = 0; m < nPts; m++) {
+      f[m] += logW[m];
+    }
+
+    // Jacobian: 2^(d_b/2) |L_b|
+    logInt[b] = logSumExp(nPts, &f[0]) + 0.5 * db * M_LN2;
+    for (i = 0; i < db; i++) {
+      logInt[b] += log(L[i + i * db]);
+    }
+  }
+
+  return 0;
+}
+
+namespace {
+
+// Working set aimed at by the tiles of tiledAghQuad: a typical per-core L2
+const int L2_BYTES = 1 << 18;
+
+// Points of a d-dimensional rule for tiledAghQuad: the nPts x d
+// (column-major) nodes x with adaptive log-weights logW & signs sign; the
+// tensor grid of the cached Gauss-Hermite rule of order n if x is NULL; or,
+// if alpha is not NULL, the shifted lattice of qmcAghQuad, with common
+// log-weight logW0
+struct GridSource {
+  int d, n, nPts;
+  const double *x, *logW, *sign;
+  const double *alpha, *shift;
+  double logW0;
+};
+
+void fillTile(const GridSource &src, int p0, int nP, double *xg,
+              double *logWg, double *signWg) {
+  //
+  // Fill points p0, ..., p0 + nP - 1 of src, scaled by sqrt(2), into xg
+  // (nP x d), with their adaptive log-weights & signs. Tensor grids are
+  // built from the mixed-radix point index, with the first coordinate
+  // varying fastest as in hermiteGrid; lattice points are mapped to
+  // standard normals by the inverse normal CDF.
+  //
+  int d = src.d, m, k;
+  if (src.alpha != NULL) {
+    for (m = 0; m < nP; m++) {
+      logWg[m] = src.logW0;
+      signWg[m] = 1.;
+    }
+    for (k = 0; k < d; k++) {
+      double *xk = &xg[k * nP];
+      for (m = 0; m < nP; m++) {
+        double u = src.shift[k] + (p0 + m + 1.) * src.alpha[k];
+        u -= floor(u);
+        if (u == 0.) u = 0.5 * DBL_EPSILON;
+        xk[m] = R::qnorm(u, 0., 1., 1, 0);
+        logWg[m] += 0.5 * xk[m] * xk[m];
+      }
+    }
+  } else if (src.x == NULL) {
+    const GHRule &rule = cachedGaussHermiteRule(src.n);
+    for (m = 0; m < nP; m++) {
+      int idx = p0 + m, i;
+      logWg[m] = 0.;
+      signWg[m] = 1.;
+      for (k = 0; k < d; k++, idx /= src.n) {
+        i = idx % src.n;
+        xg[m + k * nP] = rule.sqrt2x[i];
+        logWg[m] += rule.logAdaptW[i];
+      }
+    }
+  } else {
+    for (k = 0; k < d; k++) {
+      for (m = 0; m < nP; m++) {
+        xg[m + k * nP] = M_SQRT2 * src.x[p0 + m + k * src.nPts];
+      }
+    }
+    std::copy(src.logW + p0, src.logW + p0 + nP, logWg);
+    std::copy(src.sign + p0, src.sign + p0 + nP, signWg);
+  }
+}
+
+int tiledAghQuad(int nClusters, const GridSource &src, const double *mu,
+                 const double *sigma, int tilePoints, int tileClusters,
+                 ghqGridLogDensity logG, void *data, double *logInt) {
+  //
+  // Adaptive quadrature for many clusters on the points of src, as
+  // described for gridAghQuad. Weights may be negative; each cluster then
+  // carries a signed running sum, & a log-integral is NaN if its estimate
+  // is not positive.
+  //
+  int d = src.d, nPts = src.nPts, s, j, k, m, info;
+  char uplo = 'L';
+
+  // Cholesky factors of all scale matrices, up front
+  vector<double> L(sigma, sigma + d * d * nClusters), logDet(nClusters);
+  for (s = 0; s < nClusters; s++) {
+    double *Ls = &L[s * d * d];
+    F77_CALL(dpotrf)(&uplo, &d, Ls, &d, &info FCONE);
+    if (info != 0) return 1;
+    logDet[s] = 0.5 * d * M_LN2;
+    for (j = 0; j < d; j++) {
+      logDet[s] += log(Ls[j + j * d]);
+    }
+  }
+
+  // Tile sizes: a grid tile (d coordinates & a log-weight per point) in a
+  // quarter of L2, the stacked points & results of a call in the rest
+  const int perPoint = (d + 1) * sizeof(double);
+  if (tilePoints <= 0) {
+    tilePoints =
+        std::max((int)GH_PAD, L2_BYTES / 4 / perPoint / GH_PAD * GH_PAD);
+  }
+  tilePoints = std::min(tilePoints, nPts);
+  if (tileClusters <= 0) {
+    tileClusters = std::max(1, 3 * L2_BYTES / 4 / (perPoint * tilePoints));
+  }
+  tileClusters = std::min(tileClusters, nClusters);
+
+  vector<double> xg(tilePoints * d), logWg(tilePoints), signWg(tilePoints);
+  vector<double> z(tileClusters * tilePoints * d),
+      out(tileClusters * tilePoints);
+  vector<int> cluster(tileClusters * tilePoints);
+  vector<double> runMax(nClusters, -INFINITY), runSum(nClusters, 0.);
+
+  for (int p0 = 0; p0 < nPts; p0 += tilePoints) {
+    int nP = std::min(tilePoints, nPts - p0);
+    fillTile(src, p0, nP, &xg[0], &logWg[0], &signWg[0]);
+
+    for (int s0 = 0; s0 < nClusters; s0 += tileClusters) {
+      int nC = std::min(tileClusters, nClusters - s0), nZ = nC * nP, c;
+
+      // Fused transform z = mu_s + L_s (sqrt(2) x) for the cluster tile
+      for (c = 0; c < nC; c++) {
+        s = s0 + c;
+        const double *Ls = &L[s * d * d];
+        for (k = 0; k < d; k++) {
+          double *zk = &z[c * nP + k * nZ];
+          for (m = 0; m < nP; m++) {
+            zk[m] = mu[k + s * d];
+          }
+          for (j = 0; j <= k; j++) {
+            double Lkj = Ls[k + j * d];
+            const double *xj = &xg[j * nP];
+            for (m = 0; m < nP; m++) {
+              zk[m] += Lkj * xj[m];
+            }
+          }
+        }
+        std::fill(cluster.begin() + c * nP, cluster.begin() + (c + 1) * nP, s);
+      }
+
+      logG(nZ, d, &cluster[0], &z[0], &out[0], data);
+
+      // Fold the tile into each cluster's running log-sum-exp
+      for (c = 0; c < nC; c++) {
+        s = s0 + c;
+        double *f = &out[c * nP], tileMax = -INFINITY, sum = 0.;
+        for (m = 0; m < nP; m++) {
+          f[m] += logWg[m];
+          tileMax = std::max(tileMax, f[m]);
+        }
+        if (tileMax == -INFINITY) continue;
+        if (tileMax > runMax[s]) {
+          runSum[s] *= exp(runMax[s] - tileMax);
+          runMax[s] = tileMax;
+        }
+        for (m = 0; m < nP; m++) {
+          sum += signWg[m] * exp(f[m] - runMax[s]);
+        }
+        runSum[s] += sum;
+      }
+    }
+  }
+
+  for (s = 0; s < nClusters; s++) {
+    logInt[s] = (runSum[s] > 0.) ? runMax[s] + log(runSum[s]) + logDet[s]
+                                 : NAN;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int gridAghQuad(int nClusters, int d, int n, const double *mu,
+                const double *sigma, int tilePoints, int tileClusters,
+                ghqGridLogDensity logG, void *data, double *logInt) {
+  //
+  // Adaptive Gauss-Hermite quadrature on the full d-dimensional tensor grid
+  // of order n for many clusters,
+  //      log L_s = log \int g_s(z) dz,   s = 0, ..., nClusters - 1
+  // with nodes at mu_s + sqrt(2) L_s x, L_s the Cholesky factor of sigma_s.
+  // mu is d x nClusters & sigma d x d x nClusters (column-major).
+  //
+  // Integrating the clusters one at a time streams all n^d grid points (&
+  // their transformed images) from memory once per cluster. Instead, the
+  // grid is cut into tiles of tilePoints points, built on the fly from their
+  // mixed-radix indices, & each tile is evaluated against tiles of
+  // tileClusters clusters before moving on; the affine transform is fused
+  // into filling the stacked tile passed to logG. The grid tile is then read
+  // from cache for every cluster, & the per-cluster log-sums are carried
+  // across tiles as running log-sum-exps. tilePoints <= 0 or tileClusters
+  // <= 0 chooses tiles whose working set fits in L2_BYTES.
+  //
+  // Each call of logG covers the points of one grid tile for each cluster
+  // of one cluster tile, cluster by cluster, with their cluster indices.
+  //
+  // Returns 0 on success, 1 if some sigma_s is not positive definite & 2 if
+  // n < 1 or the grid has more than INT_MAX points.
+  //
+  if (n < 1) return 2;
+  double nPts = 1.;
+  for (int k = 0; k < d; k++) nPts *= n;
+  if (nPts > INT_MAX) return 2;
+  GridSource src = {d, n, (int)nPts, NULL, NULL, NULL, NULL, NULL, 0.};
+  return tiledAghQuad(nClusters, src, mu, sigma, tilePoints, tileClusters,
+                      logG, data, logInt);
+}
+
+int cubatureAghQuad(int nClusters, int d, int nPts, const double *x,
+                    const double *w, const double *mu, const double *sigma,
+                    int tilePoints, int tileClusters, ghqGridLogDensity logG,
+                    void *data, double *logInt) {
+  //
+  // As gridAghQuad, with the tensor grid replaced by a cubature rule for
+  // exp(-|x|^2) on R^d with nPts nodes x (nPts x d, column-major) & weights
+  // w, e.g. from sphericalRadialRule. Weights may be negative.
+  //
+  vector<double> logW(nPts), sign(nPts);
+  for (int m = 0; m < nPts; m++) {
+    double r2 = 0.;
+    for (int k = 0; k < d; k++) {
+      r2 += x[m + k * nPts] * x[m + k * nPts];
+    }
+    logW[m] = log(fabs(w[m])) + r2;
+    sign[m] = (w[m] < 0.) ? -1. : 1.;
+  }
+  GridSource src = {d, 0, nPts, x, &logW[0], &sign[0], NULL, NULL, 0.};
+  return tiledAghQuad(nClusters, src, mu, sigma, tilePoints, tileClusters,
+                      logG, data, logInt);
+}
+
+int qmcAghQuad(int nClusters, int d, int nPoints, int nShifts,
+               const double *shifts, const double *mu, const double *sigma,
+               int tilePoints, int tileClusters, ghqGridLogDensity logG,
+               void *data, double *logInt, double *stdErr) {
+  //
+  // Randomized quasi-Monte Carlo version of gridAghQuad for dimensions
+  // where no Hermite-based rule is affordable. Each cluster's integral is
+  // the expectation
+  //      \int g_s(z) dz = |L_s| E[ g_s(mu_s + L_s y) / phi(y) ]
+  // over y ~ N(0, I) with density phi, estimated on nPoints points
+  // y_i = Phi^-1(u_i) of the rank-1 lattice
+  //      u_i = frac(Delta + i alpha),   i = 1, ..., nPoints
+  // with alpha_k = frac(phi_d^-k), phi_d the positive root of
+  // x^(d+1) = x + 1 (the extensible R_d generator of Roberts, 2018), so the
+  // same tiles, transform & callbacks serve every dimension. Each of the
+  // nShifts random shifts Delta (d x nShifts, uniform on [0, 1)^d) gives an
+  // unbiased estimate; on exit, logInt contains the log of their mean & stdErr
+  // the standard error of logInt, from their spread (NaN for one shift).
+  //
+  // Returns 0 on success & 1 if some sigma_s is not positive definite.
+  //
+  int k, r, s, status;
+  double phi = 2.;
+  for (int iter = 0; iter < 60; iter++) {
+    phi = pow(1. + phi, 1. / (d + 1.));
+  }
+  vector<double> alpha(d);
+  for (k = 0; k < d; k++) {
+    alpha[k] = pow(phi, -(k + 1.));
+    alpha[k] -= floor(alpha[k]);
+  }
+
+  // One estimate per shift, on the log scale
+  vector<double> est(nShifts * nClusters);
+  for (r = 0; r < nShifts; r++) {
+    GridSource src = {d, 0, nPoints, NULL, NULL, NULL, &alpha[0],
+                      shifts + r * d,
+                      0.5 * d * log(M_PI) - log((double)nPoints)};
+    status = tiledAghQuad(nClusters, src, mu, sigma, tilePoints, tileClusters,
+                          logG, data, &est[r * nClusters]);
+    if (status != 0) return status;
+  }
+
+  for (s = 0; s < nClusters; s++) {
+    double maxEst = -INFINITY, mean = 0., var = 0.;
+    for (r = 0; r < nShifts; r++) {
+      maxEst = std::max(maxEst, est[r * nClusters + s]);
+    }
+    for (r = 0; r < nShifts; r++) {
+      mean += exp(est[r * nClusters + s] - maxEst) / nShifts;
+    }
+    for (r = 0; r < nShifts; r++) {
+      double dev = exp(est[r * nClusters + s] - maxEst) - mean;
+      var += dev * dev / (nShifts - 1.);
+    }
+    logInt[s] = maxEst + log(mean);
+    stdErr[s] = (nShifts > 1) ? sqrt(var / nShifts) / mean : NAN;
+  }
+  return 0;
+}
+
+int batchAghQuad(int nClusters, const double *mu, const double *sigma,
+                 const vector<int> &orders, double tol, int maxPoints,
+                 ghqLogDensity logG, void *data, double *logInt, int *order,
+                 double *postMean, double *postVar,
+                 vector<vector<double> > *postNodes,
+                 vector<vector<double> > *postWeights) {
+  //
+  // Adaptive Gauss-Hermite quadrature for many independent one-dimensional
+  // integrals at once,
+  //      log L_s = log \int g_s(u) du,   s = 0, ..., nClusters - 1
+  // with nodes placed at mu_s + sqrt(2) sigma_s x_i, and each cluster's
+  // order chosen from the increasing ladder orders.
+  //
+  // All clusters start at orders[0]. At each later order, the clusters
+  // still active are integrated again, & those whose log-integral changed
+  // by at most tol since the previous order are accepted. Every pass
+  // evaluates one bucket of clusters sharing the same rule, so logG sees
+  // uniform blocks of n nodes per cluster, and the total number of
+  // evaluations follows the difficulty of each cluster: clusters close to
+  // their Laplace approximation stop after the first two orders, and only
+  // the hard ones reach the largest.
+  //
+  // The nodes of all clusters in a pass are stacked, with their cluster
+  // indices, into as few calls of logG as possible: each call covers whole
+  // clusters & at most maxPoints nodes (but always at least one cluster),
+  // which also bounds the working memory. For callbacks into R, this
+  // replaces one interpreted call per cluster by a handful per pass.
+  //
+  // On exit, logInt contains the log-integrals & order the accepted order
+  // of each cluster (the largest in orders for those that never settled).
+  //
+  // The normalized terms of the accepted order are the posterior weights of
+  // the cluster's nodes, so empirical-Bayes predictions of u come from the
+  // same evaluations: unless NULL, postMean & postVar receive each
+  // cluster's posterior mean & variance, & postNodes & postWeights (each of
+  // size nClusters) its nodes & normalized weights.
+  //
+  // Returns 0 on success, 1 if orders is empty or contains an order < 1 &
+  // 2 if some sigma_s is not positive.
+  //
+  int nOrders = orders.size(), k, s, i, a, a0;
+  if (nOrders == 0) return 1;
+  for (k = 0; k < nOrders; k++) {
+    if (orders[k] < 1) return 1;
+  }
+  for (s = 0; s < nClusters; s++) {
+    if (!(sigma[s] > 0.)) return 2;
+  }
+
+  vector<int> active(nClusters), stillActive;
+  for (s = 0; s < nClusters; s++) {
+    active[s] = s;
+  }
+
+  for (k = 0; k < nOrders && !active.empty(); k++) {
+    int n = orders[k], nActive = active.size();
+    int perCall = std::max(1, std::min(nActive, maxPoints / n));
+    const GHRule &rule = cachedGaussHermiteRule(n);
+    int nPad = rule.nPad;
+    vector<double> u(perCall * n), out(perCall * n);
+    vector<int> cluster(perCall * n);
+
+    // Per-cluster terms & nodes over all nPad lanes; padding lanes keep a
+    // log-term of -Inf, so the reductions run over whole vectors
+    alignedVector logTerm(nPad, -INFINITY), z(nPad);
+
+    stillActive.clear();
+    for (a0 = 0; a0 < nActive; a0 += perCall) {
+      int nCall = std::min(perCall, nActive - a0), m = nCall * n;
+
+      // Stack nodes of this chunk of clusters for one call of logG
+      for (a = 0; a < nCall; a++) {
+        s = active[a0 + a];
+        for (i = 0; i < n; i++) {
+          u[a * n + i] = mu[s] + sigma[s] * rule.sqrt2x[i];
+          cluster[a * n + i] = s;
+        }
+      }
+      logG(m, &cluster[0], &u[0], &out[0], data);
+
+      // Reduce per cluster & compare with the previous order
+      for (a = 0; a < nCall; a++) {
+        s = active[a0 + a];
+        for (i = 0; i < n; i++) {
+          logTerm[i] = rule.logAdaptW[i] + out[a * n + i];
+        }
+        double logSum, mean, var;
+        if (postMean != NULL || postVar != NULL) {
+          for (i = 0; i < nPad; i++) {
+            z[i] = mu[s] + sigma[s] * rule.sqrt2x[i];
+          }
+          aghqLogMoments(nPad, &logTerm[0], &z[0], mu[s], &logSum, &mean,
+                         &var);
+          if (postMean != NULL) postMean[s] = mean;
+          if (postVar != NULL) postVar[s] = var;
+        } else {
+          logSum = logSumExp(nPad, &logTerm[0]);
+        }
+        if (postNodes != NULL && postWeights != NULL) {
+          (*postNodes)[s].assign(u.begin() + a * n, u.begin() + (a + 1) * n);
+          (*postWeights)[s].resize(n);
+          for (i = 0; i < n; i++) {
+            (*postWeights)[s][i] = exp(logTerm[i] - logSum);
+          }
+        }
+        double cur = log(M_SQRT2 * sigma[s]) + logSum;
+        bool settled = (k > 0) && fabs(cur - logInt[s]) <= tol;
+        logInt[s] = cur;
+        order[s] = n;
+        if (!settled) {
+          stillActive.push_back(s);
+        }
+      }
+    }
+    active.swap(stillActive);
+  }
+
+  return 0;
+}
+
+void aghqNodes(int nClusters, int n, const double *mu, const double *sigma,
+               double *u) {
+  //
+  // Nodes mu_s + sqrt(2) sigma_s x_i of the Gauss-Hermite rule of order n
+  // for each cluster, stacked cluster by cluster into u (n x nClusters), as
+  // expected by cachedAghQuad.
+  //
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  for (int s = 0; s < nClusters; s++) {
+    for (int i = 0; i < n; i++) {
+      u[i + s * n] = mu[s] + sigma[s] * rule.sqrt2x[i];
+    }
+  }
+}
+
+int cachedAghQuad(int nClusters, int n, int nBlocks, const double *partial,
+                  const double *mu, const double *sigma, double *logInt,
+                  double *postMean, double *postVar) {
+  //
+  // Adaptive Gauss-Hermite quadrature for many clusters from cached partial
+  // log-integrands. The log-integrand of cluster s at its node i (as placed
+  // by aghqNodes) is the sum over parameter blocks b of
+  //      partial[i + s * n + b * n * nClusters]
+  // e.g. the log-likelihood terms that depend on block b's parameters &
+  // the log-prior of the random effect. When a block's parameters change,
+  // only its column has to be recomputed; this reduction then costs
+  // O(nClusters n nBlocks) additions & no evaluations of the model.
+  //
+  // On exit, logInt contains the log-integrals & postMean & postVar (unless
+  // NULL) the posterior moments of each cluster, as in batchAghQuad.
+  //
+  // Returns 0 on success, 1 if n < 1 & 2 if some sigma_s is not positive.
+  //
+  if (n < 1) return 1;
+  int s, i, b, nNodes = n * nClusters;
+  for (s = 0; s < nClusters; s++) {
+    if (!(sigma[s] > 0.)) return 2;
+  }
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  int nPad = rule.nPad;
+
+  // Terms of each cluster over all nPad lanes, starting from the adaptive
+  // log-weights (-Inf in the padding), then summing the blocks column by
+  // column, so each pass streams contiguously
+  alignedVector logTerm(nPad * nClusters), z(nPad);
+  for (s = 0; s < nClusters; s++) {
+    std::copy(rule.logAdaptW.begin(), rule.logAdaptW.end(),
+              logTerm.begin() + s * nPad);
+  }
+  for (b = 0; b < nBlocks; b++) {
+    const double *col = partial + b * nNodes;
+    for (s = 0; s < nClusters; s++) {
+      for (i = 0; i < n; i++) {
+        logTerm[i + s * nPad] += col[i + s * n];
+      }
+    }
+  }
+
+  for (s = 0; s < nClusters; s++) {
+    double logSum, mean, var;
+    if (postMean != NULL || postVar != NULL) {
+      for (i = 0; i < nPad; i++) {
+        z[i] = mu[s] + sigma[s] * rule.sqrt2x[i];
+      }
+      aghqLogMoments(nPad, &logTerm[s * nPad], &z[0], mu[s], &logSum, &mean,
+                     &var);
+      if (postMean != NULL) postMean[s] = mean;
+      if (postVar != NULL) postVar[s] = var;
+    } else {
+      logSum = logSumExp(nPad, &logTerm[s * nPad]);
+    }
+    logInt[s] = log(M_SQRT2 * sigma[s]) + logSum;
+  }
+  return 0;
+}
+
+int lazyAghQuad(int n, ghqIntegrand g, void *data, double mu, double sigma,
+                double bound, double tol, int chunk, double *value,
+                int *nEval, double *errBound) {
+  //
+  // Adaptive Gauss-Hermite quadrature of order n,
+  //      \int g(z) dz ~ sqrt(2) sigma sum_i w_i exp(x_i^2) g(mu + sqrt(2)
+  //                                                         sigma x_i)
+  // evaluating g lazily, chunk nodes per call, in decreasing order of w_i
+  // and stopping as soon as the remaining nodes cannot matter.
+  //
+  // bound is an a priori bound B on |g(z)| exp(x^2), i.e. on g relative to
+  // the Gaussian kernel exp(-(z - mu)^2 / (2 sigma^2)) of the Laplace
+  // approximation, so each remaining term is at most sqrt(2) sigma B w_i.
+  // Evaluation stops once sqrt(2) sigma B times the tail mass of the
+  // weights not yet used is at most tol; with the cached weight order &
+  // tail masses, this check is O(1) per chunk.
+  //
+  // On exit, value contains the approximation, nEval the number of
+  // evaluations of g & errBound the bound on the neglected terms.
+  //
+  // Returns 0 on success & 1 if n < 1 or chunk < 1.
+  //
+  if (n < 1 || chunk < 1) return 1;
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  const GHWeightOrder &order = cachedWeightOrder(n);
+  double scale = M_SQRT2 * sigma, sum = 0.;
+  vector<double> z(chunk), out(chunk);
+  int j = 0, k, m;
+
+  while (j < n && !(scale * bound * order.tailMass[j] <= tol)) {
+    m = std::min(chunk, n - j);
+    for (k = 0; k < m; k++) {
+      z[k] = mu + sigma * rule.sqrt2x[order.perm[j + k]];
+    }
+    g(m, &z[0], &out[0], data);
+    for (k = 0; k < m; k++) {
+      int i = order.perm[j + k];
+      sum += rule.adaptW[i] * out[k];
+    }
+    j += m;
+  }
+
+  *value = scale * sum;
+  *nEval = j;
+  *errBound = (j < n) ? scale * bound * order.tailMass[j] : 0.;
+  return 0;
+}
+
+namespace {
+
+// Components share a group's rule while their scale is at least
+// MIX_MIN_SCALE_RATIO times the group's & their mean lies within
+// MIX_MAX_SHIFT group scales of its centre; within these limits the
+// reweighted integrand stays well resolved by the group's nodes
+const double MIX_MIN_SCALE_RATIO = 0.5;
+const double MIX_MAX_SHIFT = 1.;
+
+// Nodes closer than this (relative to max(1, |z|)) are evaluated once
+const double MIX_NODE_TOL = 1e-12;
+
+struct ByValue {
+  const vector<double> &v;
+  explicit ByValue(const vector<double> &v_) : v(v_) {}
+  bool operator()(int i, int j) const { return v[i] < v[j]; }
+};
+
+bool mixGroupCentre(const vector<int> &members, const double *prob,
+                    const double *mean, const double *sd, double *mu,
+                    double *sigma) {
+  //
+  // Centre & scale of the rule shared by a group of components: the mean
+  // of their mixture & the larger of its standard deviation & the largest
+  // component sd (so no component is wider than the rule). Returns whether
+  // all members are within the overlap limits for it.
+  //
+  double p = 0., m1 = 0., m2 = 0., sMax = 0.;
+  int j, nm = members.size();
+  for (j = 0; j < nm; j++) {
+    int k = members[j];
+    p += prob[k];
+    m1 += prob[k] * mean[k];
+    m2 += prob[k] * (sd[k] * sd[k] + mean[k] * mean[k]);
+    sMax = std::max(sMax, sd[k]);
+  }
+  *mu = m1 / p;
+  *sigma = std::max(sqrt(std::max(m2 / p - *mu * *mu, 0.)), sMax);
+  for (j = 0; j < nm; j++) {
+    int k = members[j];
+    if (sd[k] < MIX_MIN_SCALE_RATIO * *sigma ||
+        fabs(mean[k] - *mu) > MIX_MAX_SHIFT * *sigma) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int mixtureExpect(int K, const double *prob, const double *mean,
+                  const double *sd, int n, int merge, ghqIntegrand f,
+                  void *data, double *value, double *compValue, int *nEval) {
+  //
+  // Expectation of f under the normal mixture
+  //      sum_k prob_k N(mean_k, sd_k^2),   k = 0, ..., K - 1
+  // by Gauss-Hermite quadrature of order n, evaluating f once on a merged
+  // node set rather than once per component.
+  //
+  // Components (sorted by mean) are grouped greedily while they overlap:
+  // each group gets one rule centred at mu_g with scale sigma_g (see
+  // mixGroupCentre), & each member's expectation follows by reweighting the
+  // group's nodes z_i = mu_g + sqrt(2) sigma_g x_i,
+  //      E_k f = sum_i w_i / sqrt(pi) f(z_i) p_k(z_i) / q_g(z_i)
+  // with q_g the N(mu_g, sigma_g^2) density; the ratio is a Gaussian no
+  // narrower than half the rule, so the error stays spectral, though no
+  // longer exact for polynomials. Well-separated components keep their own
+  // rules, & with merge = 0 every component does. Nodes of all groups are
+  // then deduplicated (to MIX_NODE_TOL) & passed to f in one call, so the
+  // number of evaluations grows with the number of groups, not with K.
+  //
+  // On exit, value contains the mixture expectation, compValue (length K)
+  // each component's expectation & nEval the number of evaluations of f.
+  //
+  // Returns 0 on success, 1 if some sd_k is not positive, 2 if the
+  // probabilities do not have a positive sum & 3 if n < 1.
+  //
+  if (n < 1) return 3;
+  int k, i, g, j;
+  double pSum = 0.;
+  for (k = 0; k < K; k++) {
+    if (!(sd[k] > 0.)) return 1;
+    pSum += prob[k];
+  }
+  if (!(pSum > 0.)) return 2;
+
+  // Group components in order of their means
+  vector<int> order(K);
+  vector<double> meanV(mean, mean + K);
+  for (k = 0; k < K; k++) {
+    order[k] = k;
+  }
+  std::sort(order.begin(), order.end(), ByValue(meanV));
+
+  vector<vector<int> > groups;
+  vector<double> groupMu, groupSigma;
+  double mu, sigma;
+  for (j = 0; j < K; j++) {
+    k = order[j];
+    if (merge && !groups.empty()) {
+      vector<int> trial = groups.back();
+      trial.push_back(k);
+      if (mixGroupCentre(trial, prob, mean, sd, &mu, &sigma)) {
+        groups.back().swap(trial);
+        groupMu.back() = mu;
+        groupSigma.back() = sigma;
+        continue;
+      }
+    }
+    groups.push_back(vector<int>(1, k));
+    groupMu.push_back(mean[k]);
+    groupSigma.push_back(sd[k]);
+  }
+
+  // Nodes of all groups, deduplicated in sorted order
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  int nGroups = groups.size(), nAll = nGroups * n;
+  vector<double> zAll(nAll);
+  for (g = 0; g < nGroups; g++) {
+    for (i = 0; i < n; i++) {
+      zAll[g * n + i] = groupMu[g] + groupSigma[g] * rule.sqrt2x[i];
+    }
+  }
+  vector<int> byZ(nAll), slot(nAll);
+  for (i = 0; i < nAll; i++) {
+    byZ[i] = i;
+  }
+  std::sort(byZ.begin(), byZ.end(), ByValue(zAll));
+  vector<double> z;
+  for (i = 0; i < nAll; i++) {
+    double zi = zAll[byZ[i]];
+    if (z.empty() ||
+        fabs(zi - z.back()) > MIX_NODE_TOL * std::max(1., fabs(zi))) {
+      z.push_back(zi);
+    }
+    slot[byZ[i]] = z.size() - 1;
+  }
+
+  int m = z.size();
+  vector<double> fz(m);
+  f(m, &z[0], &fz[0], data);
+  *nEval = m;
+
+  // Reweight each group's nodes for its members, over all nPad lanes of
+  // the group's values & nodes; padding lanes have zero value & a
+  // log-weight of -Inf
+  int nPad = rule.nPad;
+  alignedVector fg(nPad, 0.), zg(nPad);
+  *value = 0.;
+  for (g = 0; g < nGroups; g++) {
+    for (i = 0; i < n; i++) {
+      fg[i] = fz[slot[g * n + i]];
+    }
+    for (i = 0; i < nPad; i++) {
+      zg[i] = groupMu[g] + groupSigma[g] * rule.sqrt2x[i];
+    }
+    for (j = 0; j < (int)groups[g].size(); j++) {
+      k = groups[g][j];
+      double sum = 0., logRatio0 = log(groupSigma[g] / sd[k]) - 0.5 * log(M_PI);
+      for (i = 0; i < nPad; i++) {
+        double r = (zg[i] - mean[k]) / sd[k];
+        sum += exp(rule.logAdaptW[i] + logRatio0 - 0.5 * r * r) * fg[i];
+      }
+      compValue[k] = sum;
+      *value += prob[k] / pSum * sum;
+    }
+  }
+  return 0;
+}
+
+namespace {
+
+// Adapters presenting vectorized R closures as native log-integrands; unit
+// and cluster indices are passed to R as 1-based integers.
+
+void callRNestedLogIntegrand(int m, const int *unit, const double *u,
+                             const double *v, double *out, void *data) {
+  using namespace Rcpp;
+  Function *f = static_cast<Function *>(data);
+
+  IntegerVector unitR(m);
+  for (int i = 0; i < m; i++) {
+    unitR[i] = unit[i] + 1;
+  }
+  NumericVector res((*f)(NumericVector(u, u + m), NumericVector(v, v + m),
+                         unitR));
+  if (res.size() != m) {
+    stop("logInner must return one value per node");
+  }
+  std::copy(res.begin(), res.end(), out);
+}
+
+void callRLogDensity(int m, const int *cluster, const double *u, double *out,
+                     void *data) {
+  using namespace Rcpp;
+  Function *f = static_cast<Function *>(data);
+
+  IntegerVector clusterR(m);
+  for (int i = 0; i < m; i++) {
+    clusterR[i] = cluster[i] + 1;
+  }
+  NumericVector res((*f)(NumericVector(u, u + m), clusterR));
+  if (res.size() != m) {
+    stop("log-density must return one value per node");
+  }
+  std::copy(res.begin(), res.end(), out);
+}
+
+void callRBlockLogIntegrand(int block, int m, int dim, const double *z,
+                            double *out, void *data) {
+  using namespace Rcpp;
+  Function *f = static_cast<Function *>(data);
+
+  NumericMatrix zR(m, dim);
+  std::copy(z, z + m * dim, zR.begin());
+  NumericVector res((*f)(zR, block + 1));
+  if (res.size() != m) {
+    stop("logG must return one value per row of its argument");
+  }
+  std::copy(res.begin(), res.end(), out);
+}
+
+void callRGridLogDensity(int m, int dim, const int *cluster, const double *z,
+                         double *out, void *data) {
+  using namespace Rcpp;
+  Function *f = static_cast<Function *>(data);
+
+  NumericMatrix zR(m, dim);
+  std::copy(z, z + m * dim, zR.begin());
+  IntegerVector clusterR(m);
+  for (int i = 0; i < m; i++) {
+    clusterR[i] = cluster[i] + 1;
+  }
+  NumericVector res((*f)(zR, clusterR));
+  if (res.size() != m) {
+    stop("logG must return one value per row of its argument");
+  }
+  std::copy(res.begin(), res.end(), out);
+}
+
+void callRIntegrand(int m, const double *z, double *out, void *data) {
+  using namespace Rcpp;
+  Function *f = static_cast<Function *>(data);
+
+  NumericVector res((*f)(NumericVector(z, z + m)));
+  if (res.size() != m) {
+    stop("g must return one value per node");
+  }
+  std::copy(res.begin(), res.end(), out);
+}
+
+}  // namespace
+
+SEXP nestedAghQuad(SEXP logInnerR, SEXP logOuterR, SEXP groupR,
+                   SEXP xOuterR, SEXP wOuterR, SEXP xInnerR, SEXP wInnerR,
+                   SEXP muR, SEXP sigmaR, SEXP muInnerR, SEXP sigmaInnerR,
+                   SEXP nAdaptR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  Function logInner(logInnerR), logOuter(logOuterR);
+
+  // Convert to 0-based cluster indices
+  IntegerVector groupIn(groupR);
+  int nUnits = groupIn.size();
+  vector<int> group(nUnits);
+  for (int j = 0; j < nUnits; j++) {
+    group[j] = groupIn[j] - 1;
+  }
+
+  vector<double> xOuter = as<vector<double> >(xOuterR);
+  vector<double> wOuter = as<vector<double> >(wOuterR);
+  vector<double> xInner = as<vector<double> >(xInnerR);
+  vector<double> wInner = as<vector<double> >(wInnerR);
+
+  // Centring is updated in place, so work on copies
+  NumericVector mu = clone(NumericVector(muR));
+  NumericVector sigma = clone(NumericVector(sigmaR));
+  NumericVector muInner(muInnerR), sigmaInner(sigmaInnerR);
+  int nClusters = mu.size();
+  int nAdapt = IntegerVector(nAdaptR)[0];
+
+  NumericVector logInt(nClusters);
+  if (nestedAghQuad(nClusters, nUnits, &group[0], xOuter, wOuter, xInner,
+                    wInner, &callRNestedLogIntegrand, &logInner,
+                    &callRLogDensity, &logOuter, nAdapt, &mu[0], &sigma[0],
+                    &muInner[0], &sigmaInner[0], &logInt[0])) {
+    stop("group must index clusters 1, ..., length(muHat)");
+  }
+
+  return List::create(Named("logIntegral") = logInt, Named("muHat") = mu,
+                      Named("sigmaHat") = sigma);
+  END_RCPP
+}
+
+SEXP factorAghQuad(SEXP logGR, SEXP blockR, SEXP xR, SEXP wR, SEXP muR,
+                   SEXP sigmaR, SEXP symmetricR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  Function logG(logGR);
+
+  // Convert to 0-based block indices
+  IntegerVector blockIn(blockR);
+  int d = blockIn.size();
+  vector<int> block(d);
+  for (int j = 0; j < d; j++) {
+    block[j] = blockIn[j] - 1;
+  }
+
+  // One rule per block
+  List xList(xR), wList(wR);
+  int nBlocks = xList.size();
+  vector<vector<double> > x(nBlocks), w(nBlocks);
+  for (int b = 0; b < nBlocks; b++) {
+    x[b] = as<vector<double> >(xList[b]);
+    w[b] = as<vector<double> >(wList[b]);
+  }
+
+  NumericVector mu(muR);
+  NumericMatrix sigma(sigmaR);
+
+  NumericVector logInt(nBlocks);
+  int symmetric = LogicalVector(symmetricR)[0];
+  int status = factorAghQuad(d, nBlocks, &block[0], x, w, &mu[0],
+                             &sigma[0], symmetric, &callRBlockLogIntegrand,
+                             &logG, &logInt[0]);
+  if (status == 1) {
+    stop("blocks must label every block 1, ..., max(blocks) at least once");
+  } else if (status == 2) {
+    stop("sigmaHat must be positive definite within each block");
+  }
+
+  return logInt;
+  END_RCPP
+}
+
+SEXP gridAghQuad(SEXP logGR, SEXP muR, SEXP sigmaR, SEXP nR, SEXP xR,
+                 SEXP wR, SEXP tilePointsR, SEXP tileClustersR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  Function logG(logGR);
+  NumericMatrix mu(muR);
+  NumericVector sigma(sigmaR);
+  int d = mu.nrow(), nClusters = mu.ncol();
+  int n = IntegerVector(nR)[0];
+  int tilePoints = IntegerVector(tilePointsR)[0];
+  int tileClusters = IntegerVector(tileClustersR)[0];
+
+  // Tensor grid of order n, unless a cubature rule (x, w) is given
+  NumericVector logInt(nClusters);
+  int status;
+  if (xR == R_NilValue) {
+    status = gridAghQuad(nClusters, d, n, &mu[0], &sigma[0], tilePoints,
+                         tileClusters, &callRGridLogDensity, &logG,
+                         &logInt[0]);
+  } else {
+    NumericMatrix x(xR);
+    NumericVector w(wR);
+    if (x.ncol() != d || x.nrow() != w.size()) {
+      stop("rule must have one column per coordinate & one weight per node");
+    }
+    status = cubatureAghQuad(nClusters, d, w.size(), &x[0], &w[0], &mu[0],
+                             &sigma[0], tilePoints, tileClusters,
+                             &callRGridLogDensity, &logG, &logInt[0]);
+  }
+  if (status == 1) {
+    stop("sigmaHat must be positive definite for every cluster");
+  } else if (status == 2) {
+    stop("n must be at least 1, with at most INT_MAX grid points");
+  }
+
+  return logInt;
+  END_RCPP
+}
+
+SEXP qmcAghQuad(SEXP logGR, SEXP muR, SEXP sigmaR, SEXP nR, SEXP shiftsR,
+                SEXP tilePointsR, SEXP tileClustersR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  Function logG(logGR);
+  NumericMatrix mu(muR);
+  NumericVector sigma(sigmaR);
+  int d = mu.nrow(), nClusters = mu.ncol();
+  int nPoints = IntegerVector(nR)[0], nShifts = IntegerVector(shiftsR)[0];
+  int tilePoints = IntegerVector(tilePointsR)[0];
+  int tileClusters = IntegerVector(tileClustersR)[0];
+
+  // Random shifts from R's generator, so results follow set.seed
+  vector<double> shifts(d * nShifts);
+  GetRNGstate();
+  for (int k = 0; k < d * nShifts; k++) {
+    shifts[k] = unif_rand();
+  }
+  PutRNGstate();
+
+  NumericVector logInt(nClusters), stdErr(nClusters);
+  int status = qmcAghQuad(nClusters, d, nPoints, nShifts, &shifts[0], &mu[0],
+                          &sigma[0], tilePoints, tileClusters,
+                          &callRGridLogDensity, &logG, &logInt[0],
+                          &stdErr[0]);
+  if (status == 1) {
+    stop("sigmaHat must be positive definite for every cluster");
+  }
+
+  logInt.attr("stdError") = stdErr;
+  return logInt;
+  END_RCPP
+}
+
+SEXP batchAghQuad(SEXP logGR, SEXP muR, SEXP sigmaR, SEXP ordersR,
+                  SEXP tolR, SEXP maxPointsR, SEXP momentsR, SEXP weightsR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  Function logG(logGR);
+  NumericVector mu(muR), sigma(sigmaR);
+  int nClusters = mu.size();
+  vector<int> orders = as<vector<int> >(ordersR);
+  double tol = NumericVector(tolR)[0];
+  int maxPoints = IntegerVector(maxPointsR)[0];
+
+  int moments = LogicalVector(momentsR)[0];
+  int weights = LogicalVector(weightsR)[0];
+
+  NumericVector logInt(nClusters), postMean(nClusters), postVar(nClusters);
+  IntegerVector order(nClusters);
+  vector<vector<double> > nodes(weights ? nClusters : 0),
+      nodeWeights(weights ? nClusters : 0);
+  int status = batchAghQuad(
+      nClusters, &mu[0], &sigma[0], orders, tol, maxPoints, &callRLogDensity,
+      &logG, &logInt[0], &order[0], moments ? &postMean[0] : NULL,
+      moments ? &postVar[0] : NULL, weights ? &nodes : NULL,
+      weights ? &nodeWeights : NULL);
+  if (status == 1) {
+    stop("orders must contain at least one order, all positive");
+  } else if (status == 2) {
+    stop("sigmaHat must be positive");
+  }
+
+  List out = List::create(Named("logIntegral") = logInt,
+                          Named("order") = order);
+  if (moments) {
+    out["postMean"] = postMean;
+    out["postVar"] = postVar;
+  }
+  if (weights) {
+    // One n x 2 matrix (u, weight) per cluster
+    List nodeList(nClusters);
+    for (int s = 0; s < nClusters; s++) {
+      int n = nodes[s].size();
+      NumericMatrix uw(n, 2);
+      std::copy(nodes[s].begin(), nodes[s].end(), uw.begin());
+      std::copy(nodeWeights[s].begin(), nodeWeights[s].end(),
+                uw.begin() + n);
+      nodeList[s] = uw;
+    }
+    out["nodes"] = nodeList;
+  }
+  return out;
+  END_RCPP
+}
+
+SEXP aghqNodes(SEXP muR, SEXP sigmaR, SEXP nR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  NumericVector mu(muR), sigma(sigmaR);
+  int nClusters = mu.size(), n = IntegerVector(nR)[0];
+  if (n < 1) {
+    stop("n must be at least 1");
+  }
+  NumericVector u(n * nClusters);
+  aghqNodes(nClusters, n, &mu[0], &sigma[0], &u[0]);
+  return u;
+  END_RCPP
+}
+
+SEXP cachedAghQuad(SEXP partialR, SEXP muR, SEXP sigmaR, SEXP nR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  NumericMatrix partial(partialR);
+  NumericVector mu(muR), sigma(sigmaR);
+  int nClusters = mu.size(), n = IntegerVector(nR)[0];
+  if (partial.nrow() != n * nClusters) {
+    stop("partial must have one row per node of each cluster");
+  }
+
+  NumericVector logInt(nClusters), postMean(nClusters), postVar(nClusters);
+  int status = cachedAghQuad(nClusters, n, partial.ncol(), &partial[0],
+                             &mu[0], &sigma[0], &logInt[0], &postMean[0],
+                             &postVar[0]);
+  if (status == 1) {
+    stop("n must be at least 1");
+  } else if (status == 2) {
+    stop("sigmaHat must be positive");
+  }
+
+  return List::create(Named("logIntegral") = logInt,
+                      Named("postMean") = postMean,
+                      Named("postVar") = postVar);
+  END_RCPP
+}
+
+SEXP mixtureExpect(SEXP fR, SEXP probR, SEXP meanR, SEXP sdR, SEXP nR,
+                   SEXP mergeR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  Function f(fR);
+  NumericVector prob(probR), mean(meanR), sd(sdR);
+  int K = prob.size(), n = IntegerVector(nR)[0];
+  int merge = LogicalVector(mergeR)[0];
+
+  double value;
+  int nEval;
+  NumericVector comp(K);
+  int status = mixtureExpect(K, &prob[0], &mean[0], &sd[0], n, merge,
+                             &callRIntegrand, &f, &value, &comp[0], &nEval);
+  if (status == 1) {
+    stop("sd must be positive");
+  } else if (status == 2) {
+    stop("prob must have a positive sum");
+  } else if (status == 3) {
+    stop("n must be a positive integer");
+  }
+
+  NumericVector out(1);
+  out[0] = value;
+  out.attr("component") = comp;
+  out.attr("nEval") = nEval;
+  return out;
+  END_RCPP
+}
+
+SEXP lazyAghQuad(SEXP gR, SEXP nR, SEXP muR, SEXP sigmaR, SEXP boundR,
+                 SEXP tolR, SEXP chunkR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  Function g(gR);
+  int n = IntegerVector(nR)[0];
+  double mu = NumericVector(muR)[0], sigma = NumericVector(sigmaR)[0];
+  double bound = NumericVector(boundR)[0], tol = NumericVector(tolR)[0];
+  int chunk = std::max(1, IntegerVector(chunkR)[0]);
+
+  double value, errBound;
+  int nEval;
+  int status = lazyAghQuad(n, &callRIntegrand, &g, mu, sigma, bound, tol,
+                           chunk, &value, &nEval, &errBound);
+  if (status == 1) {
+    stop("n must be a positive integer");
+  }
+
+  NumericVector out(1);
+  out[0] = value;
+  out.attr("nEval") = nEval;
+  out.attr("errorBound") = errBound;
+  return out;
+  END_RCPP
+}
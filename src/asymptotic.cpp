@@ -0,0 +1,202 @@
+#include "lib.h"
+#include <float.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using std::vector;
+
+namespace {
+
+// Nodes refined together in one pass of the recurrence, so that its inner
+// loop vectorizes across nodes
+const int BLOCK = 8;
+
+// Steps of the recurrence between checks for renormalization; the growth
+// over this many steps stays far below the margin between big & overflow
+const int RENORM_EVERY = 16;
+
+// First zeros of the Airy function Ai, used exactly for the largest nodes
+const double AIRY_ZEROS[10] = {
+    -2.338107410459767, -4.087949444130971, -5.520559828095551,
+    -6.786708090071759, -7.944133587120853, -9.022650853340980,
+    -10.04017434155809, -11.00852430373326, -11.93601556323626,
+    -12.82877675181880};
+
+double airyZero(int k) {
+  //
+  // k-th zero of Ai (k = 1, 2, ...), exact for k <= 10 & from its
+  // asymptotic expansion otherwise
+  //
+  if (k <= 10) {
+    return AIRY_ZEROS[k - 1];
+  }
+  double t = 3. / 8. * M_PI * (4. * k - 1.), t2 = 1. / (t * t);
+  return -pow(t, 2. / 3.) *
+         (1. + t2 * (5. / 48. +
+                     t2 * (-5. / 36. +
+                           t2 * (77125. / 82944. +
+                                 t2 * (-108056875. / 6967296. +
+                                       t2 * 162375596875. / 334430208.)))));
+}
+
+double initialGuess(int n, int j) {
+  //
+  // Asymptotic approximation to the j-th positive zero of H_n (j = 1, ...,
+  // floor(n/2), in increasing order), following Townsend, Trogdon & Olver
+  // (2016): Tricomi's expansion in the bulk & Gatteschi's Airy-type
+  // expansion for the largest zeros. Both are accurate to far less than
+  // the spacing of the zeros, so Newton's method converges to the right one.
+  //
+  int m = n / 2;
+  double a = (n % 2) ? 0.5 : -0.5, nu = 2. * n + 1.;
+
+  if (j <= (int)floor(0.4985 * n)) {
+    // Tricomi: solve T - sin(T) = rhs, then x^2 ~ nu cos(T/2)^2 + ...
+    double rhs = (4. * m - 4. * j + 3.) / nu * M_PI, T = M_PI / 2.;
+    for (int iter = 0; iter < 7; iter++) {
+      T -= (T - sin(T) - rhs) / (1. - cos(T));
+    }
+    double t = cos(T / 2.);
+    t *= t;
+    return sqrt(nu * t - (5. / (4. * (1. - t) * (1. - t)) - 1. / (1. - t) -
+                          1. + 3. * a * a) /
+                             (3. * nu));
+  }
+
+  // Gatteschi: expansion about the turning point sqrt(nu) in Airy zeros
+  double ak = airyZero(m + 1 - j);
+  double nu13 = pow(nu, 1. / 3.), c23 = pow(2., 2. / 3.),
+         c13 = pow(2., 1. / 3.);
+  double x2 = nu + c23 * ak * nu13 + 0.2 * c23 * c23 * ak * ak / nu13 +
+              (11. / 35. - a * a - 12. / 175. * ak * ak * ak) / nu +
+              (16. / 1575. * ak + 92. / 7875. * pow(ak, 4.)) * c23 /
+                  (nu * nu13 * nu13) -
+              (15152. / 3031875. * pow(ak, 5.) + 1088. / 121275. * ak * ak) *
+                  c13 / (nu * nu * nu13);
+  return sqrt(fabs(x2));
+}
+
+void newtonBlock(int n, int nb, const double *a, const double *b, double *x,
+                 double *logAbsHnm1) {
+  //
+  // Newton iteration on h_n for nb <= BLOCK nodes at once, as in
+  // hermiteNewtonStep, with the recurrence coefficients
+  //      a_k = sqrt(2 / (k+1)),   b_k = sqrt(k / (k+1))
+  // precomputed. On exit, x holds the refined nodes & logAbsHnm1 the
+  // log|h_n-1| needed for their weights.
+  //
+  const double big = 1e150, logBig = log(big);
+  const int maxIter = 10;
+  double hkm1[BLOCK], hk[BLOCK], scale[BLOCK], step;
+  int j, k, iter;
+  bool done = false;
+
+  for (iter = 0; iter <= maxIter && !done; iter++) {
+    for (j = 0; j < nb; j++) {
+      hkm1[j] = 0.;
+      hk[j] = 1.;
+      scale[j] = -0.25 * log(M_PI);
+    }
+    for (k = 0; k < n; k++) {
+      for (j = 0; j < nb; j++) {
+        double hkp1 = a[k] * x[j] * hk[j] - b[k] * hkm1[j];
+        hkm1[j] = hk[j];
+        hk[j] = hkp1;
+      }
+      if (k % RENORM_EVERY == RENORM_EVERY - 1) {
+        for (j = 0; j < nb; j++) {
+          if (fabs(hk[j]) > big || fabs(hkm1[j]) > big) {
+            hk[j] /= big;
+            hkm1[j] /= big;
+            scale[j] += logBig;
+          }
+        }
+      }
+    }
+
+    // Take the step, unless this was the final evaluation for the weights
+    done = true;
+    for (j = 0; j < nb; j++) {
+      logAbsHnm1[j] = log(fabs(hkm1[j])) + scale[j];
+      step = hk[j] / (sqrt(2. * n) * hkm1[j]);
+      if (fabs(step) > 2. * DBL_EPSILON * fabs(x[j])) {
+        done = false;
+      }
+      if (iter < maxIter) {
+        x[j] -= step;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int gaussHermiteDataAsymptotic(int n, double *x, double *w, double *logW,
+                               int nThreads) {
+  //
+  // Calculates nodes & weights for Gauss-Hermite integration of order n
+  // without an eigendecomposition, for orders where Golub-Welsch is too
+  // slow or too large (O(n^2) memory).
+  //
+  // Need x & w of size n; the rule is written directly into them, in
+  // increasing order. Unless NULL, logW (size n) receives the log-weights
+  //      log w_i = -log n - 2 log|h_n-1(x_i)|
+  // which stay finite where the weights underflow.
+  //
+  // Only the positive nodes are computed; the rest follow by symmetry. Each
+  // starts from an asymptotic approximation (see initialGuess) & is refined
+  // by Newton iteration on h_n as in polishHermiteRule, with weights
+  //      w_i = 1 / (n h_n-1(x_i)^2)
+  // Each evaluation costs O(n), so the whole rule is O(n^2). Nodes are
+  // processed in blocks of BLOCK, split over nThreads threads when built
+  // with OpenMP.
+  //
+  int m = n / 2, nBlocks = (m + BLOCK - 1) / BLOCK, k;
+  double logN = log((double)n);
+
+  // Recurrence coefficients, shared by all nodes
+  vector<double> a(n), b(n);
+  for (k = 0; k < n; k++) {
+    a[k] = sqrt(2. / (k + 1.));
+    b[k] = sqrt(k / (k + 1.));
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThreads) schedule(dynamic, 4)
+#endif
+  for (int blk = 0; blk < nBlocks; blk++) {
+    double xb[BLOCK], logAbsHnm1[BLOCK];
+    int j0 = blk * BLOCK, nb = std::min(BLOCK, m - j0), j;
+    for (j = 0; j < nb; j++) {
+      xb[j] = initialGuess(n, j0 + j + 1);
+    }
+
+    newtonBlock(n, nb, &a[0], &b[0], xb, logAbsHnm1);
+
+    // Write positive node & its mirror image
+    for (j = 0; j < nb; j++) {
+      double logWj = -logN - 2. * logAbsHnm1[j], wj = exp(logWj);
+      x[n - m + j0 + j] = xb[j];
+      w[n - m + j0 + j] = wj;
+      x[m - 1 - j0 - j] = -xb[j];
+      w[m - 1 - j0 - j] = wj;
+      if (logW != NULL) {
+        logW[n - m + j0 + j] = logW[m - 1 - j0 - j] = logWj;
+      }
+    }
+  }
+
+  // Middle node for odd n
+  if (n % 2) {
+    double logAbsHnm1;
+    hermiteNewtonStep(n, 0., &logAbsHnm1);
+    x[m] = 0.;
+    w[m] = exp(-logN - 2. * logAbsHnm1);
+    if (logW != NULL) {
+      logW[m] = -logN - 2. * logAbsHnm1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include "lib.h"
+
+using std::vector;
+
+namespace {
+
+void sphereOrbits(int d, int degree, vector<double> *s, vector<double> *ws) {
+  //
+  // Fully symmetric rule on the unit sphere in R^d, normalized to total
+  // weight 1, from the orbits of
+  //      e_k                           (2d points, weight a)
+  //      (e_k +- e_l) / sqrt(2)        (2d(d-1) points, weight b; degree 5+)
+  //      (e_k +- e_l +- e_m) / sqrt(3) ((4/3)d(d-1)(d-2) points, weight c;
+  //                                     degree 7)
+  // with all sign combinations. Odd moments vanish by symmetry, & since
+  // sum_i s_i^2 = 1 on the sphere, exactness up to degree 7 reduces to the
+  // total weight & the moments
+  //      E s_1^2 s_2^2 = 1 / (d (d+2))
+  //      E s_1^2 s_2^2 s_3^2 = 1 / (d (d+2) (d+4))
+  // which fix a, b & c. For degree 5 this is the rule of Jia, Xin & Cheng
+  // (2013), whose axis weight is negative for d > 4.
+  //
+  // On exit, s (nPts x d, column-major) contains the points & ws (nPts)
+  // their weights.
+  //
+  double dd = d, a, b = 0., c = 0.;
+  if (degree >= 7 && d >= 3) {
+    c = 27. / (8. * dd * (dd + 2.) * (dd + 4.));
+  }
+  if (degree >= 5 && d >= 2) {
+    b = 1. / (dd * (dd + 2.)) - 8. * (dd - 2.) * c / 9.;
+  }
+  a = (1. - 2. * dd * (dd - 1.) * b -
+       4. / 3. * dd * (dd - 1.) * (dd - 2.) * c) /
+      (2. * dd);
+
+  // Collect points row by row, then transpose
+  vector<vector<double> > pts;
+  vector<double> p(d);
+  int i, k, l, m, sg;
+  for (k = 0; k < d; k++) {
+    for (sg = 0; sg < 2; sg++) {
+      std::fill(p.begin(), p.end(), 0.);
+      p[k] = sg ? -1. : 1.;
+      pts.push_back(p);
+      ws->push_back(a);
+    }
+  }
+  if (b != 0.) {
+    double r = M_SQRT1_2;
+    for (k = 0; k < d; k++) {
+      for (l = k + 1; l < d; l++) {
+        for (sg = 0; sg < 4; sg++) {
+          std::fill(p.begin(), p.end(), 0.);
+          p[k] = (sg & 1) ? -r : r;
+          p[l] = (sg & 2) ? -r : r;
+          pts.push_back(p);
+          ws->push_back(b);
+        }
+      }
+    }
+  }
+  if (c != 0.) {
+    double r = 1. / sqrt(3.);
+    for (k = 0; k < d; k++) {
+      for (l = k + 1; l < d; l++) {
+        for (m = l + 1; m < d; m++) {
+          for (sg = 0; sg < 8; sg++) {
+            std::fill(p.begin(), p.end(), 0.);
+            p[k] = (sg & 1) ? -r : r;
+            p[l] = (sg & 2) ? -r : r;
+            p[m] = (sg & 4) ? -r : r;
+            pts.push_back(p);
+            ws->push_back(c);
+          }
+        }
+      }
+    }
+  }
+
+  int nPts = pts.size();
+  s->resize(nPts * d);
+  for (i = 0; i < nPts; i++) {
+    for (k = 0; k < d; k++) {
+      (*s)[i + k * nPts] = pts[i][k];
+    }
+  }
+}
+
+}  // namespace
+
+int sphericalRadialRule(int d, int degree, vector<double> *x,
+                        vector<double> *w) {
+  //
+  // Spherical-radial cubature rule of the given degree (3, 5 or 7) for
+  //      \int_{R^d} f(x) exp(-|x|^2) dx
+  // exact for polynomials f of degree up to degree, as the product of a
+  // symmetric rule on the unit sphere (sphereOrbits) & a radial rule.
+  //
+  // With x = r s & t = r^2, the radial integral is
+  //      \int_0^Inf r^(d-1) exp(-r^2) g(r) dr
+  //          = 1/2 \int_0^Inf t^(d/2-1) exp(-t) g(sqrt(t)) dt
+  // and, as odd moments vanish on the sphere, degree 2m+1 needs this exact
+  // for t^0, ..., t^m. The radial rules are generalized Gauss-Laguerre rules
+  // for alpha = d/2 - 1 via Golub-Welsch: one node for degree 3 & two for
+  // degree 7; for degree 5, the Gauss-Radau rule with a node at the origin,
+  // whose other node is the Gauss node for alpha + 1, so that the sphere
+  // collapses to a single point there. This gives 2d, 2d^2 + 1 &
+  // 4d(2d^2 - 3d + 4)/3 points (the lower bound for degree 7 grows as d^3).
+  //
+  // On exit, x (nPts x d, column-major) contains the nodes & w (nPts) the
+  // weights, which sum to pi^(d/2).
+  //
+  // Returns 0 on success, 1 for an unsupported degree & 2 if d < 1.
+  //
+  if (degree != 3 && degree != 5 && degree != 7) return 1;
+  if (d < 1) return 2;
+
+  // Radial rule in t, normalized to total weight 1; a node at 0 is kept
+  // apart as origin, with weight w0
+  int nr = (degree == 7) ? 2 : 1, j;
+  double alpha = 0.5 * d - 1., w0 = 0.;
+  vector<double> t(nr), wr(nr), D(nr), E(nr);
+  if (degree == 5) {
+    buildLaguerreJacobi(nr, alpha + 1., &D, &E);
+    quadInfoGolubWelsch(nr, D, E, 1., &t, &wr);
+    w0 = 1.;
+    for (j = 0; j < nr; j++) {
+      wr[j] *= (alpha + 1.) / t[j];
+      w0 -= wr[j];
+    }
+  } else {
+    buildLaguerreJacobi(nr, alpha, &D, &E);
+    quadInfoGolubWelsch(nr, D, E, 1., &t, &wr);
+  }
+
+  vector<double> s, ws;
+  sphereOrbits(d, degree, &s, &ws);
+  int nSph = ws.size(), hasOrigin = (degree == 5);
+  int nPts = hasOrigin + nr * nSph, i, k;
+  double total = pow(M_PI, 0.5 * d);
+
+  x->assign(nPts * d, 0.);
+  w->resize(nPts);
+  if (hasOrigin) {
+    (*w)[0] = total * w0;
+  }
+  for (j = 0; j < nr; j++) {
+    double r = sqrt(t[j]);
+    for (i = 0; i < nSph; i++) {
+      int row = hasOrigin + j * nSph + i;
+      for (k = 0; k < d; k++) {
+        (*x)[row + k * nPts] = r * s[i + k * nSph];
+      }
+      (*w)[row] = total * wr[j] * ws[i];
+    }
+  }
+  return 0;
+}
+
+SEXP sphericalRadialRule(SEXP dR, SEXP degreeR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  int d = IntegerVector(dR)[0], degree = IntegerVector(degreeR)[0];
+  vector<double> x, w;
+  int status = sphericalRadialRule(d, degree, &x, &w);
+  if (status == 1) {
+    stop("degree must be 3, 5 or 7");
+  } else if (status == 2) {
+    stop("d must be at least 1");
+  }
+
+  int nPts = w.size();
+  NumericMatrix xR(nPts, d);
+  std::copy(x.begin(), x.end(), xR.begin());
+  return List::create(Named("x") = xR, Named("w") = w);
+  END_RCPP
+}
@@ -0,0 +1,111 @@
+#include "lib.h"
+
+using std::vector;
+
+double epSiteLogLik(int link, double y, double t, double *d1, double *d2) {
+  //
+  // Log-likelihood of a binary site, log p(y | t), for label y = +/-1 and
+  // latent value t, along with its first & second derivatives in t.
+  //
+  // link is EP_LOGIT (log sigmoid(y t)) or EP_PROBIT (log Phi(y t)). Both
+  // are log-concave, so d2 <= 0.
+  //
+  double z = y * t, r;
+  if (link == EP_PROBIT) {
+    double logPhi = R::pnorm(z, 0., 1., 1, 1);
+    // Inverse Mills ratio phi(z) / Phi(z), computed on the log scale
+    r = exp(R::dnorm(z, 0., 1., 1) - logPhi);
+    *d1 = y * r;
+    *d2 = -r * (z + r);
+    return logPhi;
+  }
+
+  // Logistic; p = sigmoid(z)
+  double p = 1. / (1. + exp(-z));
+  *d1 = y * (1. - p);
+  *d2 = -p * (1. - p);
+  return (z > 0.) ? -log1p(exp(-z)) : z - log1p(exp(z));
+}
+
+int epTiltedMoments(int m, const double *mu, const double *sigma2,
+                    const double *y, int link, const vector<double> &x,
+                    const vector<double> &w, int nNewton, double *logZ,
+                    double *mean, double *var) {
+  //
+  // Moments of the tilted distributions used by expectation propagation,
+  //
+  //      p_j(t) = N(t; mu_j, sigma2_j) p(y_j | t) / Z_j
+  //
+  // for m sites at once. On exit, logZ, mean & var (length m) contain
+  // log Z_j and the mean & variance of p_j.
+  //
+  // Each site is handled in a single pass over the rule (x, w): nodes are
+  // first centred & scaled at the Laplace approximation of p_j, found with
+  // nNewton Newton steps on the closed-form derivatives of the site
+  // log-likelihood, and all three moments are then read off the same
+  // log-scale terms. Sites whose tilted distribution is much narrower than
+  // the cavity are therefore still resolved accurately.
+  //
+  // Returns 0 on success, or 1 if link is not recognized.
+  //
+  if (link != EP_LOGIT && link != EP_PROBIT) return 1;
+
+  int n = x.size(), i, j, it;
+  vector<double> logWStar(n), term(n), t(n);
+  for (i = 0; i < n; i++) {
+    logWStar[i] = log(w[i]) + x[i] * x[i];
+  }
+
+  double yj, prec, mode, d1, d2, h1, h2, scale, logSum;
+  for (j = 0; j < m; j++) {
+    yj = (y[j] > 0.) ? 1. : -1.;
+    prec = 1. / sigma2[j];
+
+    // Laplace approximation of the tilted distribution
+    mode = mu[j];
+    h2 = -prec;
+    for (it = 0; it < nNewton; it++) {
+      epSiteLogLik(link, yj, mode, &d1, &d2);
+      h1 = -(mode - mu[j]) * prec + d1;
+      h2 = -prec + d2;
+      mode -= h1 / h2;
+    }
+    epSiteLogLik(link, yj, mode, &d1, &d2);
+    h2 = -prec + d2;
+    scale = sqrt(-1. / h2);
+
+    // Adaptive quadrature of cavity density times site likelihood
+    for (i = 0; i < n; i++) {
+      t[i] = mode + M_SQRT2 * scale * x[i];
+      term[i] = logWStar[i] - 0.5 * (t[i] - mu[j]) * (t[i] - mu[j]) * prec +
+                epSiteLogLik(link, yj, t[i], &d1, &d2);
+    }
+    aghqLogMoments(n, &term[0], &t[0], mode, &logSum, &mean[j], &var[j]);
+    logZ[j] = logSum + log(M_SQRT2 * scale) - M_LN_SQRT_2PI -
+              0.5 * log(sigma2[j]);
+  }
+
+  return 0;
+}
+
+SEXP epTiltedMoments(SEXP muR, SEXP sigma2R, SEXP yR, SEXP linkR, SEXP xR,
+                     SEXP wR, SEXP nNewtonR) {
+  using namespace Rcpp;
+
+  // Convert to Rcpp objects
+  NumericVector mu(muR), sigma2(sigma2R), y(yR);
+  int m = mu.size();
+  int link = IntegerVector(linkR)[0];
+  int nNewton = IntegerVector(nNewtonR)[0];
+
+  // Allocate vectors for results
+  NumericVector logZ(m), mean(m), var(m);
+
+  // Compute moments
+  epTiltedMoments(m, &mu[0], &sigma2[0], &y[0], link,
+                  as<vector<double> >(xR), as<vector<double> >(wR), nNewton,
+                  &logZ[0], &mean[0], &var[0]);
+
+  return List::create(Named("logZ") = logZ, Named("mean") = mean,
+                      Named("var") = var);
+}
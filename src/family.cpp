@@ -0,0 +1,483 @@
+#include "lib.h"
+#include <sstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using std::vector;
+
+namespace {
+
+// Families available to familyAghQuad, by id; built-in families are added
+// on first use, others by registerGhqFamily from downstream packages
+vector<GHQFamily> familyRegistry;
+
+void binomialLogitLogLik(int m, const double *eta, const int *obs,
+                         const double *y, int nObs, const double *param,
+                         double *out) {
+  //
+  // y = (successes, trials):
+  //      log choose(y2, y1) + y1 eta - y2 log(1 + exp(eta))
+  //
+  for (int i = 0; i < m; i++) {
+    double e = eta[i], s = y[obs[i]], n = y[obs[i] + nObs];
+    double log1pExp = (e > 0.) ? e + log1p(exp(-e)) : log1p(exp(e));
+    out[i] = lgamma(n + 1.) - lgamma(s + 1.) - lgamma(n - s + 1.) + s * e -
+             n * log1pExp;
+  }
+}
+
+void binomialProbitLogLik(int m, const double *eta, const int *obs,
+                          const double *y, int nObs, const double *param,
+                          double *out) {
+  //
+  // y = (successes, trials):
+  //      log choose(y2, y1) + y1 log Phi(eta) + (y2 - y1) log Phi(-eta)
+  //
+  for (int i = 0; i < m; i++) {
+    double s = y[obs[i]], n = y[obs[i] + nObs];
+    out[i] = lgamma(n + 1.) - lgamma(s + 1.) - lgamma(n - s + 1.) +
+             s * R::pnorm(eta[i], 0., 1., 1, 1) +
+             (n - s) * R::pnorm(eta[i], 0., 1., 0, 1);
+  }
+}
+
+void poissonLogLik(int m, const double *eta, const int *obs, const double *y,
+                   int nObs, const double *param, double *out) {
+  //
+  // y = count, log link: y eta - exp(eta) - log(y!)
+  //
+  for (int i = 0; i < m; i++) {
+    double k = y[obs[i]];
+    out[i] = k * eta[i] - exp(eta[i]) - lgamma(k + 1.);
+  }
+}
+
+void addBuiltinFamilies() {
+  if (!familyRegistry.empty()) return;
+  GHQFamily builtin[3] = {{"binomial", 2, 0, &binomialLogitLogLik},
+                          {"binomial_probit", 2, 0, &binomialProbitLogLik},
+                          {"poisson", 1, 0, &poissonLogLik}};
+  familyRegistry.assign(builtin, builtin + 3);
+}
+
+// (point, observation) pairs buffered per call of a family's kernel: large
+// enough to amortize the call, small enough to stay in L1
+const int PAIR_BLOCK = 256;
+
+// Pairs awaiting the family's kernel, whose log-likelihoods are added to
+// out[owner] as each block is flushed, so that no points x observations
+// intermediate is ever built
+struct PairBuffer {
+  const GHQFamily *family;
+  const double *y, *param;
+  int nObs, fill;
+  double *out;
+  int obs[PAIR_BLOCK], owner[PAIR_BLOCK];
+  double eta[PAIR_BLOCK], ll[PAIR_BLOCK];
+
+  void flush() {
+    if (fill == 0) return;
+    family->logLik(fill, eta, obs, y, nObs, param, ll);
+    for (int p = 0; p < fill; p++) {
+      out[owner[p]] += ll[p];
+    }
+    fill = 0;
+  }
+
+  void push(int i, int j, double e) {
+    owner[fill] = i;
+    obs[fill] = j;
+    eta[fill] = e;
+    if (++fill == PAIR_BLOCK) flush();
+  }
+};
+
+// Data for familyLogDensity
+struct FamilyModel {
+  const GHQFamily *family;
+  const int *obsStart;
+  const double *y, *offset, *param;
+  int nObs, nThreads;
+  double tau;
+};
+
+void familyLogDensity(int m, const int *cluster, const double *u,
+                      double *out, void *data) {
+  //
+  // Log-density of a random-intercept GLMM cluster at u,
+  //      log N(u; 0, tau^2) + sum_{j in cluster} log p(y_j | offset_j + u)
+  // for m stacked points. The (point, observation) pairs are streamed
+  // through a PairBuffer per chunk of points; chunks are spread over
+  // nThreads threads when built with OpenMP, which is safe since kernels
+  // never call into R.
+  //
+  const FamilyModel *model = static_cast<const FamilyModel *>(data);
+  double logNorm = -log(model->tau) - 0.5 * log(2. * M_PI);
+  int nChunks = std::min(m, 4 * model->nThreads);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(model->nThreads) schedule(dynamic, 1)
+#endif
+  for (int c = 0; c < nChunks; c++) {
+    int i0 = (int)((double)m * c / nChunks),
+        i1 = (int)((double)m * (c + 1) / nChunks);
+    PairBuffer buf;
+    buf.family = model->family;
+    buf.y = model->y;
+    buf.param = model->param;
+    buf.nObs = model->nObs;
+    buf.fill = 0;
+    buf.out = out;
+    for (int i = i0; i < i1; i++) {
+      double r = u[i] / model->tau;
+      out[i] = logNorm - 0.5 * r * r;
+      for (int j = model->obsStart[cluster[i]];
+           j < model->obsStart[cluster[i] + 1]; j++) {
+        buf.push(i, j, model->offset[j] + u[i]);
+      }
+    }
+    buf.flush();
+  }
+}
+
+// Data for slopesLogDensity: observations obsIndex[obsStart[s]], ...,
+// obsIndex[obsStart[s+1] - 1] of cluster s, with the rows of the random
+// effects design in CSR form (rowPtr, colIdx, zVal) & the Cholesky factor
+// LG of the random effects covariance
+struct SlopesModel {
+  const GHQFamily *family;
+  const int *obsStart, *obsIndex, *rowPtr, *colIdx;
+  const double *zVal, *y, *offset, *param, *LG;
+  int nObs, nThreads;
+  double logNorm;
+};
+
+void slopesLogDensity(int m, int dim, const int *cluster, const double *u,
+                      double *out, void *data) {
+  //
+  // Log-density of a GLMM cluster with random effects u (dim-dimensional),
+  //      log N(u; 0, G) + sum_{j in cluster} log p(y_j | offset_j + Z_j u)
+  // at m stacked points u (m x dim, column-major). Each linear predictor is
+  // a sparse dot product over the nonzeros of row j of Z, formed as the
+  // pair is pushed to the PairBuffer, so the cost per pair is nnz(Z_j) &
+  // only PAIR_BLOCK predictors are live at a time. Chunks of points are
+  // threaded as in familyLogDensity.
+  //
+  const SlopesModel *model = static_cast<const SlopesModel *>(data);
+  int nChunks = std::min(m, 4 * model->nThreads);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(model->nThreads) schedule(dynamic, 1)
+#endif
+  for (int c = 0; c < nChunks; c++) {
+    int i0 = (int)((double)m * c / nChunks),
+        i1 = (int)((double)m * (c + 1) / nChunks);
+    PairBuffer buf;
+    buf.family = model->family;
+    buf.y = model->y;
+    buf.param = model->param;
+    buf.nObs = model->nObs;
+    buf.fill = 0;
+    buf.out = out;
+    vector<double> v(dim);
+    for (int i = i0; i < i1; i++) {
+      // Prior, by forward substitution L_G v = u
+      double r2 = 0.;
+      for (int k = 0; k < dim; k++) {
+        double t = u[i + k * m];
+        for (int l = 0; l < k; l++) {
+          t -= model->LG[k + l * dim] * v[l];
+        }
+        v[k] = t / model->LG[k + k * dim];
+        r2 += v[k] * v[k];
+      }
+      out[i] = model->logNorm - 0.5 * r2;
+
+      for (int q = model->obsStart[cluster[i]];
+           q < model->obsStart[cluster[i] + 1]; q++) {
+        int j = model->obsIndex[q];
+        double eta = model->offset[j];
+        for (int p = model->rowPtr[j]; p < model->rowPtr[j + 1]; p++) {
+          eta += model->zVal[p] * u[i + model->colIdx[p] * m];
+        }
+        buf.push(i, j, eta);
+      }
+    }
+    buf.flush();
+  }
+}
+
+void cscToCsr(int nRow, int nCol, const int *colPtr, const int *rowIdx,
+              const double *val, vector<int> *rowPtr, vector<int> *colIdx,
+              vector<double> *rowVal) {
+  //
+  // Transpose the storage of a sparse matrix from compressed columns to
+  // compressed rows, by a counting sort on the row indices; columns stay in
+  // increasing order within each row.
+  //
+  int nnz = colPtr[nCol], i, k, p;
+  rowPtr->assign(nRow + 1, 0);
+  colIdx->resize(nnz);
+  rowVal->resize(nnz);
+  for (p = 0; p < nnz; p++) {
+    (*rowPtr)[rowIdx[p] + 1]++;
+  }
+  for (i = 0; i < nRow; i++) {
+    (*rowPtr)[i + 1] += (*rowPtr)[i];
+  }
+  vector<int> next(rowPtr->begin(), rowPtr->end() - 1);
+  for (k = 0; k < nCol; k++) {
+    for (p = colPtr[k]; p < colPtr[k + 1]; p++) {
+      int q = next[rowIdx[p]]++;
+      (*colIdx)[q] = k;
+      (*rowVal)[q] = val[p];
+    }
+  }
+}
+
+}  // namespace
+
+int registerGhqFamily(const char *name, int yDim, int nParam,
+                      ghqFamilyLogLik logLik) {
+  //
+  // Add a native family for familyAghQuad, described by its name, the number
+  // of columns of its response (yDim) & of its parameters (nParam), & its
+  // vectorized log-likelihood kernel. Registering an existing name replaces
+  // that family (e.g. when a package is reloaded).
+  //
+  // Returns the id of the family, or -1 if the descriptor is invalid.
+  //
+  if (name == NULL || logLik == NULL || yDim < 1 || nParam < 0) return -1;
+  addBuiltinFamilies();
+  GHQFamily family = {name, yDim, nParam, logLik};
+  for (int id = 0; id < (int)familyRegistry.size(); id++) {
+    if (familyRegistry[id].name == name) {
+      familyRegistry[id] = family;
+      return id;
+    }
+  }
+  familyRegistry.push_back(family);
+  return familyRegistry.size() - 1;
+}
+
+const GHQFamily *findGhqFamily(const char *name) {
+  addBuiltinFamilies();
+  for (int id = 0; id < (int)familyRegistry.size(); id++) {
+    if (familyRegistry[id].name == name) return &familyRegistry[id];
+  }
+  return NULL;
+}
+
+int familyAghQuad(const GHQFamily &family, int nClusters, const int *obsStart,
+                  const double *y, int nObs, const double *offset,
+                  const double *param, double tau, const double *mu,
+                  const double *sigma, const vector<int> &orders, double tol,
+                  int maxPoints, int nThreads, double *logInt, int *order,
+                  double *postMean, double *postVar) {
+  //
+  // Marginal log-likelihood of each cluster of a random-intercept GLMM
+  //      log \int N(u; 0, tau^2) prod_{j in cluster} p(y_j | offset_j + u) du
+  // by batchAghQuad, with the family's native kernel in place of any R
+  // callback. Observations of cluster s are obsStart[s], ...,
+  // obsStart[s+1] - 1, rows of the nObs x yDim response y.
+  //
+  // Returns the status of batchAghQuad, or 3 if tau is not positive.
+  //
+  if (!(tau > 0.)) return 3;
+  FamilyModel model = {&family, obsStart, y, offset, param, nObs,
+                       std::max(1, nThreads), tau};
+  return batchAghQuad(nClusters, mu, sigma, orders, tol, maxPoints,
+                      &familyLogDensity, &model, logInt, order, postMean,
+                      postVar, NULL, NULL);
+}
+
+int slopesAghQuad(const GHQFamily &family, int nClusters, int d,
+                  const int *obsStart, const int *obsIndex, const int *rowPtr,
+                  const int *colIdx, const double *zVal, const double *y,
+                  int nObs, const double *offset, const double *param,
+                  const double *G, int n, int nPts, const double *x,
+                  const double *w, const double *mu, const double *sigma,
+                  int nThreads, double *logInt) {
+  //
+  // Marginal log-likelihood of each cluster of a GLMM with d correlated
+  // random effects (e.g. an intercept & slopes),
+  //      log \int N(u; 0, G) prod_{j in cluster} p(y_j | offset_j + Z_j u) du
+  // with Z the nObs x d random effects design in CSR form (rowPtr, colIdx,
+  // zVal). Observations of cluster s are rows obsIndex[obsStart[s]], ...,
+  // obsIndex[obsStart[s+1] - 1] of y, offset & Z, so the data need not be
+  // sorted by cluster.
+  //
+  // Integrates on the tensor grid of order n by gridAghQuad, or, if x is not
+  // NULL, on the nPts-point cubature rule (x, w) by cubatureAghQuad, centred
+  // at mu (d x nClusters) & scaled by sigma (d x d x nClusters). The sparse
+  // products Z_j u are fused into the evaluation of each node (see
+  // slopesLogDensity), & with no R callbacks, tiles are sized for L2.
+  //
+  // Returns the status of gridAghQuad or cubatureAghQuad, or 3 if G is not
+  // positive definite.
+  //
+  vector<double> LG(G, G + d * d);
+  char uplo = 'L';
+  int info;
+  F77_CALL(dpotrf)(&uplo, &d, &LG[0], &d, &info FCONE);
+  if (info != 0) return 3;
+  double logNorm = -0.5 * d * log(2. * M_PI);
+  for (int k = 0; k < d; k++) {
+    logNorm -= log(LG[k + k * d]);
+  }
+
+  SlopesModel model = {&family, obsStart, obsIndex, rowPtr, colIdx, zVal, y,
+                       offset, param, &LG[0], nObs, std::max(1, nThreads),
+                       logNorm};
+  if (x == NULL) {
+    return gridAghQuad(nClusters, d, n, mu, sigma, 0, 0, &slopesLogDensity,
+                       &model, logInt);
+  }
+  return cubatureAghQuad(nClusters, d, nPts, x, w, mu, sigma, 0, 0,
+                         &slopesLogDensity, &model, logInt);
+}
+
+SEXP familyAghQuad(SEXP familyR, SEXP yR, SEXP obsStartR, SEXP offsetR,
+                   SEXP paramR, SEXP tauR, SEXP muR, SEXP sigmaR,
+                   SEXP ordersR, SEXP tolR, SEXP maxPointsR, SEXP threadsR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  std::string name = as<std::string>(familyR);
+  const GHQFamily *family = findGhqFamily(name.c_str());
+  if (family == NULL) {
+    stop("no native family named '" + name + "' is registered");
+  }
+
+  NumericMatrix y(yR);
+  NumericVector offset(offsetR), param(paramR), mu(muR), sigma(sigmaR);
+  IntegerVector obsStart(obsStartR);
+  int nObs = y.nrow(), nClusters = mu.size();
+  if (y.ncol() != family->yDim || param.size() != family->nParam) {
+    std::ostringstream msg;
+    msg << "family '" << name << "' needs a response with " << family->yDim
+        << " column(s) & " << family->nParam << " parameter(s)";
+    stop(msg.str());
+  }
+
+  vector<int> orders = as<vector<int> >(ordersR);
+  NumericVector logInt(nClusters), postMean(nClusters), postVar(nClusters);
+  IntegerVector order(nClusters);
+  int status = familyAghQuad(
+      *family, nClusters, &obsStart[0], &y[0], nObs, &offset[0],
+      param.size() ? &param[0] : NULL, NumericVector(tauR)[0], &mu[0],
+      &sigma[0], orders, NumericVector(tolR)[0], IntegerVector(maxPointsR)[0],
+      IntegerVector(threadsR)[0], &logInt[0], &order[0], &postMean[0],
+      &postVar[0]);
+  if (status == 1) {
+    stop("orders must contain at least one order, all positive");
+  } else if (status == 2) {
+    stop("sigmaHat must be positive");
+  } else if (status == 3) {
+    stop("tau must be positive");
+  }
+
+  return List::create(Named("logIntegral") = logInt, Named("order") = order,
+                      Named("postMean") = postMean,
+                      Named("postVar") = postVar);
+  END_RCPP
+}
+
+SEXP slopesAghQuad(SEXP familyR, SEXP yR, SEXP obsStartR, SEXP obsIndexR,
+                   SEXP zPtrR, SEXP zIdxR, SEXP zValR, SEXP zByRowR,
+                   SEXP offsetR, SEXP paramR, SEXP GR, SEXP muR, SEXP sigmaR,
+                   SEXP nR, SEXP xR, SEXP wR, SEXP threadsR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  std::string name = as<std::string>(familyR);
+  const GHQFamily *family = findGhqFamily(name.c_str());
+  if (family == NULL) {
+    stop("no native family named '" + name + "' is registered");
+  }
+
+  NumericMatrix y(yR), mu(muR);
+  NumericVector offset(offsetR), param(paramR), G(GR), sigma(sigmaR);
+  IntegerVector obsStart(obsStartR), obsIndex(obsIndexR);
+  IntegerVector zPtr(zPtrR), zIdx(zIdxR);
+  NumericVector zVal(zValR);
+  int nObs = y.nrow(), d = mu.nrow(), nClusters = mu.ncol();
+  if (y.ncol() != family->yDim || param.size() != family->nParam) {
+    std::ostringstream msg;
+    msg << "family '" << name << "' needs a response with " << family->yDim
+        << " column(s) & " << family->nParam << " parameter(s)";
+    stop(msg.str());
+  }
+
+  // Random effects design in CSR form, transposing compressed columns
+  vector<int> rowPtr, colIdx;
+  vector<double> rowVal;
+  if (as<bool>(zByRowR)) {
+    rowPtr.assign(zPtr.begin(), zPtr.end());
+    colIdx.assign(zIdx.begin(), zIdx.end());
+    rowVal.assign(zVal.begin(), zVal.end());
+  } else {
+    cscToCsr(nObs, d, &zPtr[0], &zIdx[0], &zVal[0], &rowPtr, &colIdx,
+             &rowVal);
+  }
+  if ((int)rowPtr.size() != nObs + 1) {
+    stop("Z must have one row per observation");
+  }
+  for (size_t p = 0; p < colIdx.size(); p++) {
+    if (colIdx[p] < 0 || colIdx[p] >= d) {
+      stop("Z must have one column per random effect");
+    }
+  }
+  if (rowVal.empty()) {
+    rowVal.push_back(0.);
+    colIdx.push_back(0);
+  }
+
+  NumericVector logInt(nClusters);
+  int status;
+  if (xR == R_NilValue) {
+    status = slopesAghQuad(
+        *family, nClusters, d, &obsStart[0], &obsIndex[0], &rowPtr[0],
+        &colIdx[0], &rowVal[0], &y[0], nObs, &offset[0],
+        param.size() ? &param[0] : NULL, &G[0], IntegerVector(nR)[0], 0, NULL,
+        NULL, &mu[0], &sigma[0], IntegerVector(threadsR)[0], &logInt[0]);
+  } else {
+    NumericMatrix x(xR);
+    NumericVector w(wR);
+    if (x.ncol() != d || x.nrow() != w.size()) {
+      stop("rule must have one column per coordinate & one weight per node");
+    }
+    status = slopesAghQuad(
+        *family, nClusters, d, &obsStart[0], &obsIndex[0], &rowPtr[0],
+        &colIdx[0], &rowVal[0], &y[0], nObs, &offset[0],
+        param.size() ? &param[0] : NULL, &G[0], 0, w.size(), &x[0], &w[0],
+        &mu[0], &sigma[0], IntegerVector(threadsR)[0], &logInt[0]);
+  }
+  if (status == 1) {
+    stop("sigmaHat must be positive definite for every cluster");
+  } else if (status == 2) {
+    stop("n must be at least 1, with at most INT_MAX grid points");
+  } else if (status == 3) {
+    stop("G must be positive definite");
+  }
+
+  return logInt;
+  END_RCPP
+}
+
+SEXP ghqFamilies() {
+  using namespace Rcpp;
+
+  addBuiltinFamilies();
+  int nFamilies = familyRegistry.size();
+  CharacterVector name(nFamilies);
+  IntegerVector yDim(nFamilies), nParam(nFamilies);
+  for (int id = 0; id < nFamilies; id++) {
+    name[id] = familyRegistry[id].name;
+    yDim[id] = familyRegistry[id].yDim;
+    nParam[id] = familyRegistry[id].nParam;
+  }
+  return List::create(Named("name") = name, Named("yDim") = yDim,
+                      Named("nParam") = nParam);
+}
@@ -0,0 +1,909 @@
+#include "lib.h"
+#include <map>
+#include <float.h>
+
+using std::vector;
+
+namespace {
+
+//
+// Chebyshev treecode for the Cauchy-like sums arising in the
+// divide-and-conquer eigensolver,
+//
+//      out_j = sum_i q_i K(s_i - t_j),   K(u) = 1/u, 1/u^2 or log|u|
+//
+// or, for K_SECULAR, the three sums with K(u) = 1/u, 1/u^2 & 1/|u| from a
+// single traversal (stored one after another in out).
+//
+// Points are stored as an index into a reference array plus an offset, so
+// that differences between nearby points (e.g. a secular root and its
+// nearest pole) are formed exactly. Sources must be sorted by value.
+//
+// Source clusters far from a target (distance >= ETA radii from their
+// centre) are replaced by p Chebyshev proxies, giving O((n + m) p log n)
+// work in place of O(n m); near clusters are summed directly.
+//
+
+enum { K_INV = 0, K_INV2 = 1, K_LOG = 2, K_SECULAR = 3 };
+
+struct Pt {
+  int base;
+  double off;
+};
+
+const double ETA = 3.;
+const int LEAF = 64;
+const int DIRECT_MAX = 256;
+
+template <int TYPE>
+inline void accumulate(double q, double u, double *acc) {
+  if (TYPE == K_INV) {
+    acc[0] += q / u;
+  } else if (TYPE == K_INV2) {
+    acc[0] += q / (u * u);
+  } else if (TYPE == K_LOG) {
+    acc[0] += q * log(fabs(u));
+  } else {
+    double r = 1. / u;
+    acc[0] += q * r;
+    acc[1] += q * r * r;
+    acc[2] += q * fabs(r);
+  }
+}
+
+struct TreeNode {
+  int begin, end, left, right;
+  double c, r;
+};
+
+class Treecode {
+ public:
+  Treecode(const vector<double> &ref, const vector<Pt> &src, int p)
+      : ref_(ref), src_(src), p_(p), b_(p) {
+    for (int m = 0; m < p_; m++) {
+      b_[m] = ((m % 2) ? -1. : 1.) * sin((2. * m + 1.) * M_PI / (2. * p_));
+    }
+    if ((int)src_.size() > DIRECT_MAX) {
+      build(0, src_.size());
+    }
+  }
+
+  void eval(const vector<double> &q, const vector<Pt> &tgt, int type,
+            bool skipSelf, double *out) {
+    switch (type) {
+      case K_INV:
+        eval<K_INV>(q, tgt, skipSelf, out);
+        break;
+      case K_INV2:
+        eval<K_INV2>(q, tgt, skipSelf, out);
+        break;
+      case K_LOG:
+        eval<K_LOG>(q, tgt, skipSelf, out);
+        break;
+      default:
+        eval<K_SECULAR>(q, tgt, skipSelf, out);
+    }
+  }
+
+ private:
+  const vector<double> &ref_;
+  const vector<Pt> &src_;
+  int p_;
+  vector<double> b_, proxyY_, proxyQ_;
+  vector<TreeNode> nodes_;
+
+  double value(const Pt &a) const { return ref_[a.base] + a.off; }
+
+  template <int TYPE>
+  void eval(const vector<double> &q, const vector<Pt> &tgt, bool skipSelf,
+            double *out) {
+    int n = src_.size(), m = tgt.size(), nOut = (TYPE == K_SECULAR) ? 3 : 1;
+    int i, j, l;
+    double acc[3];
+    vector<int> stack;
+
+    if (n > DIRECT_MAX) upward(q);
+    for (j = 0; j < m; j++) {
+      double t = value(tgt[j]);
+      acc[0] = acc[1] = acc[2] = 0.;
+      if (n <= DIRECT_MAX) {
+        direct<TYPE>(q, 0, n, tgt[j], skipSelf, acc);
+      } else {
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty()) {
+          int k = stack.back();
+          const TreeNode &node = nodes_[k];
+          stack.pop_back();
+          if (node.r > 0. && fabs(t - node.c) >= ETA * node.r) {
+            const double *Q = &proxyQ_[k * p_], *Y = &proxyY_[k * p_];
+            for (i = 0; i < p_; i++) {
+              accumulate<TYPE>(Q[i], Y[i] - t, acc);
+            }
+          } else if (node.left < 0) {
+            direct<TYPE>(q, node.begin, node.end, tgt[j], skipSelf, acc);
+          } else {
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+          }
+        }
+      }
+      for (l = 0; l < nOut; l++) {
+        out[l * m + j] = acc[l];
+      }
+    }
+  }
+
+  template <int TYPE>
+  void direct(const vector<double> &q, int begin, int end, const Pt &t,
+              bool skipSelf, double *acc) const {
+    double tRef = ref_[t.base];
+    for (int i = begin; i < end; i++) {
+      if (skipSelf && src_[i].base == t.base && src_[i].off == t.off) {
+        continue;
+      }
+      accumulate<TYPE>(q[i],
+                       (ref_[src_[i].base] - tRef) + (src_[i].off - t.off),
+                       acc);
+    }
+  }
+
+  int build(int begin, int end) {
+    int k = nodes_.size();
+    TreeNode node;
+    node.begin = begin;
+    node.end = end;
+    node.left = node.right = -1;
+    double lo = value(src_[begin]), hi = value(src_[end - 1]);
+    node.c = 0.5 * (lo + hi);
+    node.r = 0.5 * (hi - lo);
+    nodes_.push_back(node);
+
+    proxyY_.resize((k + 1) * p_);
+    for (int m = 0; m < p_; m++) {
+      proxyY_[k * p_ + m] =
+          node.c + node.r * cos((2. * m + 1.) * M_PI / (2. * p_));
+    }
+
+    if (end - begin > LEAF) {
+      int mid = begin + (end - begin) / 2;
+      int left = build(begin, mid);
+      int right = build(mid, end);
+      nodes_[k].left = left;
+      nodes_[k].right = right;
+    }
+    return k;
+  }
+
+  void interpolate(int k, double s, double w) {
+    //
+    // Spread weight w at location s onto the Chebyshev proxies of node k,
+    // using the barycentric Lagrange basis
+    //
+    const double *y = &proxyY_[k * p_];
+    double *Q = &proxyQ_[k * p_], denom = 0.;
+    int m;
+    for (m = 0; m < p_; m++) {
+      if (s == y[m]) {
+        Q[m] += w;
+        return;
+      }
+      denom += b_[m] / (s - y[m]);
+    }
+    for (m = 0; m < p_; m++) {
+      Q[m] += w * b_[m] / (s - y[m]) / denom;
+    }
+  }
+
+  void upward(const vector<double> &q) {
+    // Children are created after their parents, so a reverse sweep visits
+    // every node after both of its children
+    proxyQ_.assign(nodes_.size() * p_, 0.);
+    for (int k = nodes_.size() - 1; k >= 0; k--) {
+      const TreeNode &node = nodes_[k];
+      if (node.r <= 0.) continue;
+      if (node.left < 0) {
+        for (int i = node.begin; i < node.end; i++) {
+          interpolate(k, value(src_[i]), q[i]);
+        }
+      } else {
+        int children[2] = {node.left, node.right};
+        for (int c = 0; c < 2; c++) {
+          int kc = children[c];
+          if (nodes_[kc].r > 0.) {
+            for (int m = 0; m < p_; m++) {
+              interpolate(k, proxyY_[kc * p_ + m], proxyQ_[kc * p_ + m]);
+            }
+          } else {
+            for (int i = nodes_[kc].begin; i < nodes_[kc].end; i++) {
+              interpolate(k, value(src_[i]), q[i]);
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+//
+// Divide-and-conquer eigendecomposition of the Hermite Jacobi matrix
+// (Cuppen, 1981; Gu & Eisenstat, 1995), J = V diag(x) V', stored in
+// factored form. Each merge writes
+//
+//      V = diag(V_1, V_2) P R U
+//
+// where P sorts the children's eigenvalues, R holds the Givens rotations
+// used for deflation, and U is the Cauchy-like eigenvector matrix of the
+// rank-one update D + rho z z'. Only the O(n) parameters of each merge are
+// stored, and U is applied with the treecode, so the factorization takes
+// O(n log n) memory and applying V or V' costs O(n log^2 n).
+//
+// The columns of V are the vectors (h_k(x_i) sqrt(w_i))_k up to sign.
+//
+
+struct Rotation {
+  int i, j;
+  double c, s;
+};
+
+struct DCBlock {
+  int size, left, right, nLeft;
+  // Dense eigenvectors for leaves
+  vector<double> V;
+  // Merge parameters
+  vector<int> perm, kept, deflated, lamBase, outPerm;
+  vector<double> dKept, zHat, lamOff, nInv;
+  vector<Rotation> rot;
+};
+
+const int DC_LEAF = 32;
+
+template <typename T>
+struct ValueLess {
+  const vector<T> &v;
+  explicit ValueLess(const vector<T> &v_) : v(v_) {}
+  bool operator()(int a, int b) const { return v[a] < v[b]; }
+};
+
+void argsort(const vector<double> &v, vector<int> *order) {
+  order->resize(v.size());
+  for (size_t i = 0; i < v.size(); i++) (*order)[i] = i;
+  std::stable_sort(order->begin(), order->end(), ValueLess<double>(v));
+}
+
+int proxyOrder(double tol) {
+  // Chebyshev proxies needed for relative accuracy tol at separation ETA
+  double rho = ETA + sqrt(ETA * ETA - 1.);
+  return std::max(4, (int)ceil(-log(tol) / log(rho)) + 3);
+}
+
+class HermiteDC {
+ public:
+  vector<double> eig, lastRow;
+
+  HermiteDC() : tol_(0.), p_(0), root_(-1) {}
+  HermiteDC(int n, double tol) { factor(n, tol); }
+
+  // Factor the Jacobi matrix of order n at accuracy tol, replacing any
+  // previous factorization
+  void factor(int n, double tol) {
+    tol_ = tol;
+    p_ = proxyOrder(tol);
+    blocks_.clear();
+    vector<double> D(n), E(n), first;
+    buildHermiteJacobi(n, &D, &E);
+    root_ = build(0, n, D, E, &eig, &first, &lastRow);
+  }
+
+  // out (eigenvalue order) = V' y (row order)
+  void applyVT(const double *y, double *out) const { applyVT(root_, y, out); }
+
+  // out (row order) = V y (eigenvalue order)
+  void applyV(const double *y, double *out) const { applyV(root_, y, out); }
+
+ private:
+  double tol_;
+  int p_, root_;
+  vector<DCBlock> blocks_;
+
+  int build(int offset, int size, vector<double> &D, const vector<double> &E,
+            vector<double> *eigOut, vector<double> *first,
+            vector<double> *last) {
+    int k = blocks_.size(), i, j;
+    blocks_.push_back(DCBlock());
+    blocks_[k].size = size;
+    blocks_[k].left = blocks_[k].right = -1;
+
+    if (size <= DC_LEAF) {
+      // Dense eigendecomposition via LAPACK
+      char JOBZ = 'V';
+      int INFO;
+      vector<double> d(D.begin() + offset, D.begin() + offset + size);
+      vector<double> e(E.begin() + offset, E.begin() + offset + size);
+      vector<double> WORK(2 * size), V(size * size);
+      F77_NAME(dstev)(&JOBZ, &size, &d[0], &e[0], &V[0], &size, &WORK[0],
+                      &INFO FCONE);
+      eigOut->assign(d.begin(), d.end());
+      first->resize(size);
+      last->resize(size);
+      for (j = 0; j < size; j++) {
+        (*first)[j] = V[j * size];
+        (*last)[j] = V[size - 1 + j * size];
+      }
+      blocks_[k].V.swap(V);
+      return k;
+    }
+
+    // Split J = diag(T_1, T_2) + beta v v', v = e_m-1 + e_m
+    int m = size / 2;
+    double beta = E[offset + m - 1];
+    D[offset + m - 1] -= beta;
+    D[offset + m] -= beta;
+
+    vector<double> eig1, first1, last1, eig2, first2, last2;
+    int left = build(offset, m, D, E, &eig1, &first1, &last1);
+    int right = build(offset + m, size - m, D, E, &eig2, &first2, &last2);
+
+    DCBlock &B = blocks_[k];
+    B.left = left;
+    B.right = right;
+    B.nLeft = m;
+
+    // Poles & update vector z = [last row of V_1, first row of V_2]
+    vector<double> cat(eig1), zCat(last1);
+    cat.insert(cat.end(), eig2.begin(), eig2.end());
+    zCat.insert(zCat.end(), first2.begin(), first2.end());
+    argsort(cat, &B.perm);
+    vector<double> d(size), z(size);
+    double zNorm = 0.;
+    for (i = 0; i < size; i++) {
+      d[i] = cat[B.perm[i]];
+      z[i] = zCat[B.perm[i]];
+      zNorm += z[i] * z[i];
+    }
+    zNorm = sqrt(zNorm);
+    for (i = 0; i < size; i++) {
+      z[i] /= zNorm;
+    }
+    double rho = beta * zNorm * zNorm;
+
+    deflate(&B, rho, &d, &z);
+    secular(&B, rho, d, z);
+
+    // Eigenvalues of this block, sorted
+    int K = B.kept.size();
+    vector<double> combined(size);
+    for (j = 0; j < K; j++) {
+      combined[j] = B.dKept[B.lamBase[j]] + B.lamOff[j];
+    }
+    for (i = 0; i < (int)B.deflated.size(); i++) {
+      combined[K + i] = d[B.deflated[i]];
+    }
+    argsort(combined, &B.outPerm);
+    eigOut->resize(size);
+    for (i = 0; i < size; i++) {
+      (*eigOut)[i] = combined[B.outPerm[i]];
+    }
+
+    // First & last rows for the parent merge
+    vector<double> t(size, 0.);
+    std::copy(first1.begin(), first1.end(), t.begin());
+    first->resize(size);
+    mergeT(k, &t[0], &(*first)[0]);
+    std::fill(t.begin(), t.end(), 0.);
+    std::copy(last2.begin(), last2.end(), t.begin() + m);
+    last->resize(size);
+    mergeT(k, &t[0], &(*last)[0]);
+
+    return k;
+  }
+
+  void deflate(DCBlock *B, double rho, vector<double> *d, vector<double> *z) {
+    //
+    // Deflation as in LAPACK dlaed2: drop components with negligible
+    // rho |z_i|, and rotate away one of any pair of poles close enough that
+    // the coupling left behind is negligible.
+    //
+    int n = d->size(), i, pj = -1;
+    double scale = rho;
+    for (i = 0; i < n; i++) {
+      scale = std::max(scale, fabs((*d)[i]));
+    }
+    double tol = std::max(tol_, 8. * DBL_EPSILON) * scale;
+
+    vector<char> isDeflated(n, 0);
+    for (i = 0; i < n; i++) {
+      if (rho * fabs((*z)[i]) <= tol) {
+        isDeflated[i] = 1;
+        continue;
+      }
+      if (pj >= 0) {
+        double c = (*z)[i], s = (*z)[pj];
+        double tau = sqrt(c * c + s * s);
+        c /= tau;
+        s = -s / tau;
+        if (fabs(((*d)[i] - (*d)[pj]) * c * s) <= tol) {
+          Rotation r = {pj, i, c, s};
+          B->rot.push_back(r);
+          (*z)[i] = tau;
+          (*z)[pj] = 0.;
+          double t = (*d)[pj] * c * c + (*d)[i] * s * s;
+          (*d)[i] = (*d)[pj] * s * s + (*d)[i] * c * c;
+          (*d)[pj] = t;
+          isDeflated[pj] = 1;
+        }
+      }
+      pj = i;
+    }
+
+    for (i = 0; i < n; i++) {
+      if (isDeflated[i]) {
+        B->deflated.push_back(i);
+      } else {
+        B->kept.push_back(i);
+        B->dKept.push_back((*d)[i]);
+      }
+    }
+  }
+
+  void secular(DCBlock *B, double rho, const vector<double> &d,
+               const vector<double> &z) {
+    //
+    // Solve the secular equation
+    //      f(lambda) = 1 + rho sum_i z_i^2 / (d_i - lambda) = 0
+    // for the K non-deflated poles. Root j lies in (d_j, d_j+1) (or
+    // (d_K-1, d_K-1 + rho) for the last) and is stored as an offset from
+    // its nearer pole. All roots are iterated together; each sweep
+    // evaluates f & f' with the treecode and takes a safeguarded step of
+    // the fixed-weight model that treats the two bracketing poles exactly
+    // (Bunch, Nielsen & Sorensen, 1978).
+    //
+    // The eigenvector weights zHat are then recomputed from the roots
+    // (Gu & Eisenstat, 1995) so that U is numerically orthogonal.
+    //
+    int K = B->kept.size(), i, j, it;
+    const vector<double> &dK = B->dKept;
+    B->lamBase.resize(K);
+    B->lamOff.resize(K);
+    B->zHat.resize(K);
+    B->nInv.resize(K);
+    if (K == 0) return;
+
+    vector<double> zeta(K);
+    vector<Pt> poles(K);
+    double zetaSum = 0.;
+    for (i = 0; i < K; i++) {
+      zeta[i] = z[B->kept[i]] * z[B->kept[i]];
+      zetaSum += zeta[i];
+      poles[i].base = i;
+      poles[i].off = 0.;
+    }
+
+    if (K == 1) {
+      B->lamBase[0] = 0;
+      B->lamOff[0] = rho * zeta[0];
+      B->zHat[0] = (z[B->kept[0]] > 0.) ? 1. : -1.;
+      B->nInv[0] = fabs(B->lamOff[0]);
+      return;
+    }
+
+    Treecode tree(dK, poles, p_);
+    vector<Pt> lam(K);
+    vector<double> f(K), lo(K), hi(K), delta(K);
+    vector<int> other(K);
+    vector<char> done(K, 0);
+
+    // Choose origin (nearer pole) from the sign of f at interval midpoints
+    for (j = 0; j < K; j++) {
+      lam[j].base = j;
+      lam[j].off = (j < K - 1) ? 0.5 * (dK[j + 1] - dK[j]) : 0.5 * rho;
+    }
+    tree.eval(zeta, lam, K_INV, false, &f[0]);
+    for (j = 0; j < K; j++) {
+      double half = lam[j].off;
+      if (j == K - 1) {
+        // Last root: origin d_K-1, bracket (0, rho * sum(zeta)]
+        lo[j] = 0.;
+        hi[j] = rho * zetaSum * (1. + 4. * DBL_EPSILON);
+        other[j] = j - 1;
+      } else if (1. + rho * f[j] >= 0.) {
+        lo[j] = 0.;
+        hi[j] = half;
+        other[j] = j + 1;
+      } else {
+        lam[j].base = j + 1;
+        lo[j] = -half;
+        hi[j] = 0.;
+        other[j] = j;
+      }
+      delta[j] = dK[other[j]] - dK[lam[j].base];
+      lam[j].off = 0.5 * (lo[j] + hi[j]);
+    }
+
+    // f is only known to about fTol times the sum of its absolute terms
+    double fTol = std::max(tol_ / 16., 8. * DBL_EPSILON);
+    vector<double> fLo(K, 0.), fHi(K, 0.);
+    vector<Pt> active;
+    vector<int> activeIdx;
+    vector<double> fa;
+    for (it = 0; it < 100; it++) {
+      active.clear();
+      activeIdx.clear();
+      for (j = 0; j < K; j++) {
+        if (!done[j]) {
+          active.push_back(lam[j]);
+          activeIdx.push_back(j);
+        }
+      }
+      if (active.empty()) break;
+      int nActive = active.size();
+      fa.resize(3 * nActive);
+      tree.eval(zeta, active, K_SECULAR, false, &fa[0]);
+
+      for (size_t a = 0; a < active.size(); a++) {
+        j = activeIdx[a];
+        double tau = lam[j].off;
+        double fj = 1. + rho * fa[a], fpj = rho * fa[nActive + a];
+        if (fabs(fj) <= fTol * (1. + rho * fa[2 * nActive + a])) {
+          done[j] = 1;
+          continue;
+        }
+        if (fj < 0.) {
+          lo[j] = tau;
+          fLo[j] = fj;
+        } else {
+          hi[j] = tau;
+          fHi[j] = fj;
+        }
+
+        // Fixed-weight model: exact origin pole, remainder fitted by a pole
+        // at the other bracket end
+        double s = rho * zeta[lam[j].base];
+        double R = fj + s / tau, Rp = fpj - s / (tau * tau);
+        double Dq = delta[j] - tau;
+        double S = std::max(Rp, 0.) * Dq * Dq;
+        double c = R - S / Dq;
+        double Bq = c * delta[j] + s + S;
+        double next = lo[j];
+        if (c == 0.) {
+          if (Bq != 0.) next = s * delta[j] / Bq;
+        } else {
+          double disc = Bq * Bq - 4. * c * s * delta[j];
+          if (disc >= 0.) {
+            double qq = 0.5 * (Bq + ((Bq >= 0.) ? sqrt(disc) : -sqrt(disc)));
+            double r1 = qq / c, r2 = (qq != 0.) ? s * delta[j] / qq : r1;
+            bool in1 = r1 > lo[j] && r1 < hi[j];
+            bool in2 = r2 > lo[j] && r2 < hi[j];
+            if (in1 && in2) {
+              next = (fabs(r1 - tau) < fabs(r2 - tau)) ? r1 : r2;
+            } else if (in1) {
+              next = r1;
+            } else if (in2) {
+              next = r2;
+            }
+          }
+        }
+
+        // Safeguard: regula falsi once f is known at both ends of the
+        // bracket, bisection before then
+        if (!(next > lo[j] && next < hi[j])) {
+          if (fLo[j] < 0. && fHi[j] > 0.) {
+            next = lo[j] + (hi[j] - lo[j]) * fLo[j] / (fLo[j] - fHi[j]);
+          }
+          if (!(next > lo[j] && next < hi[j])) {
+            next = 0.5 * (lo[j] + hi[j]);
+          }
+        }
+
+        if (fabs(next - tau) <= 4. * DBL_EPSILON * fabs(next) ||
+            hi[j] - lo[j] <= 4. * DBL_EPSILON * std::max(fabs(lo[j]),
+                                                         fabs(hi[j]))) {
+          done[j] = 1;
+        }
+        lam[j].off = next;
+      }
+    }
+    for (j = 0; j < K; j++) {
+      B->lamBase[j] = lam[j].base;
+      B->lamOff[j] = lam[j].off;
+    }
+
+    // zHat_i^2 = prod_j (lambda_j - d_i) / (rho prod_{k != i} (d_k - d_i))
+    vector<double> ones(K, 1.), logNum(K), logDen(K);
+    Treecode lamTree(dK, lam, p_);
+    lamTree.eval(ones, poles, K_LOG, false, &logNum[0]);
+    tree.eval(ones, poles, K_LOG, true, &logDen[0]);
+    vector<double> zHat2(K);
+    for (i = 0; i < K; i++) {
+      double zi = exp(0.5 * (logNum[i] - logDen[i] - log(rho)));
+      B->zHat[i] = (z[B->kept[i]] >= 0.) ? zi : -zi;
+      zHat2[i] = zi * zi;
+    }
+
+    // Column norms of U
+    vector<double> nrm2(K);
+    tree.eval(zHat2, lam, K_INV2, false, &nrm2[0]);
+    for (j = 0; j < K; j++) {
+      B->nInv[j] = 1. / sqrt(nrm2[j]);
+    }
+  }
+
+  void mergeT(int k, const double *t, double *out) const {
+    //
+    // out (this block's eigenvalue order) = (P R U)' t, with t in the
+    // children's concatenated eigenvalue order
+    //
+    const DCBlock &B = blocks_[k];
+    int n = B.size, K = B.kept.size(), i, j;
+    vector<double> a(n);
+    for (i = 0; i < n; i++) {
+      a[i] = t[B.perm[i]];
+    }
+    for (size_t r = 0; r < B.rot.size(); r++) {
+      const Rotation &g = B.rot[r];
+      double ai = a[g.i], aj = a[g.j];
+      a[g.i] = g.c * ai + g.s * aj;
+      a[g.j] = g.c * aj - g.s * ai;
+    }
+
+    vector<double> combined(n), q(K);
+    for (i = 0; i < K; i++) {
+      q[i] = B.zHat[i] * a[B.kept[i]];
+    }
+    if (K > 0) {
+      vector<Pt> poles(K), lam(K);
+      for (i = 0; i < K; i++) {
+        poles[i].base = i;
+        poles[i].off = 0.;
+        lam[i].base = B.lamBase[i];
+        lam[i].off = B.lamOff[i];
+      }
+      Treecode tree(B.dKept, poles, p_);
+      tree.eval(q, lam, K_INV, false, &combined[0]);
+      for (j = 0; j < K; j++) {
+        combined[j] *= B.nInv[j];
+      }
+    }
+    for (i = 0; i < (int)B.deflated.size(); i++) {
+      combined[K + i] = a[B.deflated[i]];
+    }
+    for (i = 0; i < n; i++) {
+      out[i] = combined[B.outPerm[i]];
+    }
+  }
+
+  void merge(int k, const double *y, double *t) const {
+    //
+    // t (children's concatenated eigenvalue order) = P R U y, with y in this
+    // block's eigenvalue order
+    //
+    const DCBlock &B = blocks_[k];
+    int n = B.size, K = B.kept.size(), i;
+    vector<double> combined(n), a(n);
+    for (i = 0; i < n; i++) {
+      combined[B.outPerm[i]] = y[i];
+    }
+    for (i = 0; i < (int)B.deflated.size(); i++) {
+      a[B.deflated[i]] = combined[K + i];
+    }
+    if (K > 0) {
+      vector<Pt> poles(K), lam(K);
+      vector<double> q(K), s(K);
+      for (i = 0; i < K; i++) {
+        poles[i].base = i;
+        poles[i].off = 0.;
+        lam[i].base = B.lamBase[i];
+        lam[i].off = B.lamOff[i];
+        q[i] = B.nInv[i] * combined[i];
+      }
+      Treecode tree(B.dKept, lam, p_);
+      tree.eval(q, poles, K_INV, false, &s[0]);
+      for (i = 0; i < K; i++) {
+        a[B.kept[i]] = -B.zHat[i] * s[i];
+      }
+    }
+    for (int r = B.rot.size() - 1; r >= 0; r--) {
+      const Rotation &g = B.rot[r];
+      double ai = a[g.i], aj = a[g.j];
+      a[g.i] = g.c * ai - g.s * aj;
+      a[g.j] = g.s * ai + g.c * aj;
+    }
+    for (i = 0; i < n; i++) {
+      t[B.perm[i]] = a[i];
+    }
+  }
+
+  void applyVT(int k, const double *y, double *out) const {
+    const DCBlock &B = blocks_[k];
+    int n = B.size, i, j;
+    if (B.left < 0) {
+      for (j = 0; j < n; j++) {
+        out[j] = 0.;
+        for (i = 0; i < n; i++) {
+          out[j] += B.V[i + j * n] * y[i];
+        }
+      }
+      return;
+    }
+    vector<double> t(n);
+    applyVT(B.left, y, &t[0]);
+    applyVT(B.right, y + B.nLeft, &t[B.nLeft]);
+    mergeT(k, &t[0], out);
+  }
+
+  void applyV(int k, const double *y, double *out) const {
+    const DCBlock &B = blocks_[k];
+    int n = B.size, i, j;
+    if (B.left < 0) {
+      for (i = 0; i < n; i++) {
+        out[i] = 0.;
+      }
+      for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+          out[i] += B.V[i + j * n] * y[j];
+        }
+      }
+      return;
+    }
+    vector<double> t(n);
+    merge(k, y, &t[0]);
+    applyV(B.left, &t[0], out);
+    applyV(B.right, &t[B.nLeft], out + B.nLeft);
+  }
+};
+
+struct FastTransform {
+  HermiteDC dc;
+  vector<double> logW, sgn;
+};
+
+// Factorizations by order & tolerance, kept for the session
+std::map<std::pair<int, double>, FastTransform> dcCache;
+
+const FastTransform &cachedFastTransform(int n, double tol) {
+  //
+  // Return the factorization of order n at accuracy tol, along with the
+  // log-weights & column signs of the rule, computing them on first use.
+  //
+  // Neither can be read off the first row of V, whose entries underflow
+  // (or are lost to rounding) once w_i < tol: the signs come from the last
+  // row instead, where |V_n-1,i| = 1 / sqrt(n) and the sign of
+  // h_n-1(x_i) is (-1)^(n-1-i), and the weights from
+  //
+  //      w_i = 1 / (n h_n-1(x_i)^2),
+  //      h_n-1(x) = sqrt(2^(n-1) / ((n-1)! sqrt(pi))) prod_j (x - xi_j)
+  //
+  // with xi_j the nodes of order n - 1, summed on the log scale with the
+  // treecode. Both are then accurate relative to w_i, far into the tails.
+  //
+  std::pair<int, double> key(n, tol);
+  std::map<std::pair<int, double>, FastTransform>::iterator it =
+      dcCache.find(key);
+  if (it != dcCache.end()) {
+    return it->second;
+  }
+
+  FastTransform &ft = dcCache[key];
+  ft.dc.factor(n, tol);
+  const vector<double> &x = ft.dc.eig;
+  int i;
+
+  ft.sgn.resize(n);
+  for (i = 0; i < n; i++) {
+    bool odd = (n - 1 - i) % 2;
+    ft.sgn[i] = ((ft.dc.lastRow[i] >= 0.) != odd) ? 1. : -1.;
+  }
+
+  ft.logW.assign(n, 0.5 * log(M_PI));
+  if (n > 1) {
+    vector<double> xi;
+    {
+      HermiteDC lower(n - 1, DBL_EPSILON);
+      xi.swap(lower.eig);
+    }
+    vector<Pt> src(n - 1), tgt(n);
+    vector<double> ones(n - 1, 1.), logProd(n);
+    for (i = 0; i < n - 1; i++) {
+      src[i].base = i;
+      src[i].off = 0.;
+    }
+    for (i = 0; i < n; i++) {
+      tgt[i].base = std::min(i, n - 2);
+      tgt[i].off = x[i] - xi[tgt[i].base];
+    }
+    Treecode tree(xi, src, proxyOrder(DBL_EPSILON));
+    tree.eval(ones, tgt, K_LOG, false, &logProd[0]);
+
+    double logLead =
+        (n - 1) * M_LN2 - lgamma((double)n) - M_LN_SQRT_PI;
+    for (i = 0; i < n; i++) {
+      ft.logW[i] = -log((double)n) - logLead - 2. * logProd[i];
+    }
+  }
+  return ft;
+}
+
+}  // namespace
+
+void fastHermiteTransform(int n, int nCol, const double *in, int inverse,
+                          int type, double tol, double *out,
+                          vector<double> *x, vector<double> *w) {
+  //
+  // Fast approximate version of hermiteTransform for large n.
+  //
+  // The orthogonal transform matrix Q_ki = h_k(x_i) sqrt(w_i) is the
+  // eigenvector matrix V of the Hermite Jacobi matrix, up to column signs,
+  // so it is applied through the divide-and-conquer factorization above:
+  // O(n log^2 n) time per column and O(n log n) memory after an
+  // O(n log^2 n) setup, in place of O(n^2) for both. Results are accurate
+  // to about tol relative to the norm of the (scaled) input.
+  //
+  // The nodes & weights are those of the same factorization; on exit, x &
+  // w contain them if non-NULL.
+  //
+  const FastTransform &ft = cachedFastTransform(n, tol);
+  const HermiteDC &dc = ft.dc;
+  int i, j;
+
+  // Diagonal scaling as in hermiteTransform, folded with the column signs
+  vector<double> scale(n);
+  for (i = 0; i < n; i++) {
+    double logS = 0.5 * ft.logW[i];
+    if (type == HT_POLYNOMIAL) {
+      logS -= 0.25 * log(M_PI);
+    } else {
+      logS += 0.5 * dc.eig[i] * dc.eig[i];
+    }
+    scale[i] = exp(logS);
+  }
+
+  vector<double> col(n);
+  for (j = 0; j < nCol; j++) {
+    const double *y = in + j * n;
+    double *o = out + j * n;
+    if (!inverse) {
+      for (i = 0; i < n; i++) {
+        col[i] = ft.sgn[i] * scale[i] * y[i];
+      }
+      dc.applyV(&col[0], o);
+    } else {
+      dc.applyVT(y, &col[0]);
+      for (i = 0; i < n; i++) {
+        o[i] = ft.sgn[i] * col[i] / scale[i];
+      }
+    }
+  }
+
+  if (x != NULL) {
+    x->assign(dc.eig.begin(), dc.eig.end());
+  }
+  if (w != NULL) {
+    w->resize(n);
+    for (i = 0; i < n; i++) {
+      (*w)[i] = exp(ft.logW[i]);
+    }
+  }
+}
+
+SEXP fastHermiteTransform(SEXP inR, SEXP inverseR, SEXP typeR, SEXP tolR) {
+  using namespace Rcpp;
+
+  // Convert to Rcpp objects
+  NumericMatrix in(inR);
+  int n = in.nrow(), nCol = in.ncol();
+  int inverse = LogicalVector(inverseR)[0];
+  int type = IntegerVector(typeR)[0];
+  double tol = NumericVector(tolR)[0];
+
+  // Allocate matrix for results
+  NumericMatrix out(n, nCol);
+
+  // Run transform; nodes are returned as an attribute, since the dense
+  // generators are impractical at the orders this is intended for
+  vector<double> x;
+  fastHermiteTransform(n, nCol, &in[0], inverse, type, tol, &out[0], &x,
+                       NULL);
+  out.attr("x") = x;
+
+  return out;
+}
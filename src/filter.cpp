@@ -0,0 +1,267 @@
+#include "lib.h"
+#include <R_ext/BLAS.h>
+
+using std::vector;
+
+namespace {
+
+int sigmaPoints(int nPts, int d, const double *m, const double *P,
+                const vector<double> &xi, double *L, double *X) {
+  //
+  // Place the cached standard grid xi (nPts x d) at N(m, P):
+  //      X = 1 m' + xi L'
+  // where L is the lower Cholesky factor of P. L (d x d) and X (nPts x d)
+  // are column-major; returns the dpotrf status.
+  //
+  int i, k, info;
+  char uplo = 'L', side = 'R', trans = 'T', diag = 'N';
+  double one = 1.;
+
+  std::copy(P, P + d * d, L);
+  F77_CALL(dpotrf)(&uplo, &d, L, &d, &info FCONE);
+  if (info != 0) return info;
+  for (k = 0; k < d; k++) {
+    for (i = k + 1; i < d; i++) {
+      L[k + i * d] = 0.;
+    }
+  }
+
+  std::copy(xi.begin(), xi.end(), X);
+  F77_CALL(dtrmm)(&side, &uplo, &trans, &diag, &nPts, &d, &one, L, &d, X,
+                  &nPts FCONE FCONE FCONE FCONE);
+  for (k = 0; k < d; k++) {
+    for (i = 0; i < nPts; i++) {
+      X[i + k * nPts] += m[k];
+    }
+  }
+  return 0;
+}
+
+void weightedMoments(int nPts, int d, const double *F,
+                     const vector<double> &W, const vector<double> &sqrtW,
+                     double *mean, double *cov, double *centred) {
+  //
+  // Weighted mean (length d) & covariance (d x d) of the rows of F
+  // (nPts x d). On exit, centred holds sqrt(W) * (F - 1 mean'), which is
+  // reused for cross-covariances; the covariance is formed with dsyrk.
+  //
+  int i, k;
+  char uplo = 'L', trans = 'T';
+  double one = 1., zero = 0.;
+
+  for (k = 0; k < d; k++) {
+    mean[k] = 0.;
+    for (i = 0; i < nPts; i++) {
+      mean[k] += W[i] * F[i + k * nPts];
+    }
+    for (i = 0; i < nPts; i++) {
+      centred[i + k * nPts] = sqrtW[i] * (F[i + k * nPts] - mean[k]);
+    }
+  }
+
+  F77_CALL(dsyrk)(&uplo, &trans, &d, &nPts, &one, centred, &nPts, &zero, cov,
+                  &d FCONE FCONE);
+  for (k = 0; k < d; k++) {
+    for (i = k + 1; i < d; i++) {
+      cov[k + i * d] = cov[i + k * d];
+    }
+  }
+}
+
+}  // namespace
+
+int ghKalmanFilter(int nTime, int dState, int dObs, const double *y,
+                   const double *m0, const double *P0, const double *Q,
+                   const double *R, const vector<double> &x,
+                   const vector<double> &w, ghfMap transition, void *fData,
+                   ghfMap measurement, void *hData, double *mPred,
+                   double *PPred, double *mFilt, double *PFilt,
+                   double *logLik) {
+  //
+  // Gauss-Hermite filter (Ito & Xiong, 2000) for the nonlinear state-space
+  // model
+  //
+  //      x_t = f_t(x_{t-1}) + q_t,   q_t ~ N(0, Q)
+  //      y_t = h_t(x_t) + r_t,       r_t ~ N(0, R)
+  //
+  // with x_0 ~ N(m0, P0), run forward over all nTime observations in one
+  // call.
+  //
+  // The tensor-product grid of the rule (x, w) in dState dimensions is built
+  // once and reused at every step. Each time & measurement update places the
+  // grid at the current Gaussian via its Cholesky factor, passes all points
+  // through transition or measurement in a single call, and forms the
+  // predicted moments with BLAS (dsyrk for covariances, dgemm for the
+  // cross-covariance & gain).
+  //
+  // y is dObs x nTime (column-major); observations with any NaN component
+  // skip the measurement update. On exit, mPred & mFilt are dState x nTime,
+  // PPred & PFilt are dState x dState x nTime, and logLik holds the
+  // log-likelihood of the observed series.
+  //
+  // Returns 0 on success; otherwise 1 + the (0-based) time index at which a
+  // covariance matrix failed to be positive definite.
+  //
+  int d = dState, p = dObs, dd = d * d;
+  int nPts, i, k, t, info;
+  char uplo = 'L', notrans = 'N', trans = 'T';
+  double one = 1., zero = 0., minusOne = -1.;
+
+  // Cached standard normal grid: xi = sqrt(2) x, weights w / pi^(d/2)
+  vector<double> xi, W;
+  hermiteGrid(d, x, w, &xi, &W);
+  nPts = W.size();
+  vector<double> sqrtW(nPts);
+  for (i = 0; i < nPts; i++) {
+    double ss = 0.;
+    for (k = 0; k < d; k++) {
+      ss += xi[i + k * nPts] * xi[i + k * nPts];
+      xi[i + k * nPts] *= M_SQRT2;
+    }
+    W[i] = exp(W[i] - ss - d * M_LN_SQRT_PI);
+    sqrtW[i] = sqrt(W[i]);
+  }
+
+  // Workspace
+  vector<double> m(m0, m0 + d), P(P0, P0 + dd), L(dd);
+  vector<double> X(nPts * d), F(nPts * d), Xc(nPts * d);
+  vector<double> Y(nPts * p), Yc(nPts * p);
+  vector<double> yHat(p), S(p * p), C(d * p), K(d * p), resid(p), white(p);
+
+  *logLik = 0.;
+  for (t = 0; t < nTime; t++) {
+    // Time update
+    if (sigmaPoints(nPts, d, &m[0], &P[0], xi, &L[0], &X[0])) return t + 1;
+    transition(t, nPts, d, &X[0], d, &F[0], fData);
+    weightedMoments(nPts, d, &F[0], W, sqrtW, &mPred[t * d], &PPred[t * dd],
+                    &Xc[0]);
+    for (i = 0; i < dd; i++) {
+      PPred[t * dd + i] += Q[i];
+    }
+    std::copy(&mPred[t * d], &mPred[t * d] + d, m.begin());
+    std::copy(&PPred[t * dd], &PPred[t * dd] + dd, P.begin());
+
+    // Skip measurement update for missing observations
+    bool observed = true;
+    for (k = 0; k < p; k++) {
+      if (ISNAN(y[t * p + k])) observed = false;
+    }
+
+    if (observed) {
+      // Measurement update
+      if (sigmaPoints(nPts, d, &m[0], &P[0], xi, &L[0], &X[0])) {
+        return t + 1;
+      }
+      measurement(t, nPts, d, &X[0], p, &Y[0], hData);
+      weightedMoments(nPts, p, &Y[0], W, sqrtW, &yHat[0], &S[0], &Yc[0]);
+      for (i = 0; i < p * p; i++) {
+        S[i] += R[i];
+      }
+
+      // Cross-covariance C = (X - m)' W (Y - yHat)
+      for (k = 0; k < d; k++) {
+        for (i = 0; i < nPts; i++) {
+          Xc[i + k * nPts] = sqrtW[i] * (X[i + k * nPts] - m[k]);
+        }
+      }
+      F77_CALL(dgemm)(&trans, &notrans, &d, &p, &nPts, &one, &Xc[0], &nPts,
+                      &Yc[0], &nPts, &zero, &C[0], &d FCONE FCONE);
+
+      // Innovation
+      for (k = 0; k < p; k++) {
+        resid[k] = y[t * p + k] - yHat[k];
+      }
+
+      // Cholesky of S = L L'; log N(y; yHat, S) by forward substitution
+      F77_CALL(dpotrf)(&uplo, &p, &S[0], &p, &info FCONE);
+      if (info != 0) return t + 1;
+      *logLik -= p * M_LN_SQRT_2PI;
+      for (k = 0; k < p; k++) {
+        double z = resid[k];
+        for (i = 0; i < k; i++) {
+          z -= S[k + i * p] * white[i];
+        }
+        white[k] = z / S[k + k * p];
+        *logLik -= log(S[k + k * p]) + 0.5 * white[k] * white[k];
+      }
+
+      // Gain K = C S^-1: solve S K' = C'
+      for (k = 0; k < p; k++) {
+        for (i = 0; i < d; i++) {
+          K[k + i * p] = C[i + k * d];
+        }
+      }
+      F77_CALL(dpotrs)(&uplo, &p, &d, &S[0], &p, &K[0], &p, &info FCONE);
+
+      // m += K (y - yHat); P -= C K'
+      for (i = 0; i < d; i++) {
+        for (k = 0; k < p; k++) {
+          m[i] += K[k + i * p] * resid[k];
+        }
+      }
+      F77_CALL(dgemm)(&notrans, &notrans, &d, &d, &p, &minusOne, &C[0], &d,
+                      &K[0], &p, &one, &P[0], &d FCONE FCONE);
+      for (k = 0; k < d; k++) {
+        for (i = k + 1; i < d; i++) {
+          P[i + k * d] = P[k + i * d] = 0.5 * (P[i + k * d] + P[k + i * d]);
+        }
+      }
+    }
+
+    std::copy(m.begin(), m.end(), &mFilt[t * d]);
+    std::copy(P.begin(), P.end(), &PFilt[t * dd]);
+  }
+
+  return 0;
+}
+
+namespace {
+
+void callRMap(int t, int m, int dIn, const double *x, int dOut, double *out,
+              void *data) {
+  using namespace Rcpp;
+  Function *f = static_cast<Function *>(data);
+
+  NumericMatrix xR(m, dIn);
+  std::copy(x, x + m * dIn, xR.begin());
+  NumericMatrix res((*f)(xR, t + 1));
+  if (res.nrow() != m || res.ncol() != dOut) {
+    stop("transition & measurement functions must return one row per point, "
+         "with one column per state & observation dimension, respectively");
+  }
+  std::copy(res.begin(), res.end(), out);
+}
+
+}  // namespace
+
+SEXP ghKalmanFilter(SEXP yR, SEXP m0R, SEXP P0R, SEXP QR, SEXP RR, SEXP xR,
+                    SEXP wR, SEXP transitionR, SEXP measurementR) {
+  using namespace Rcpp;
+  BEGIN_RCPP
+
+  // y is dObs x nTime; moments are returned as matrices & flat arrays
+  NumericMatrix y(yR);
+  NumericVector m0(m0R);
+  NumericMatrix P0(P0R), Q(QR), R(RR);
+  Function transition(transitionR), measurement(measurementR);
+  int dObs = y.nrow(), nTime = y.ncol(), d = m0.size();
+
+  NumericMatrix mPred(d, nTime), mFilt(d, nTime);
+  NumericVector PPred(d * d * nTime), PFilt(d * d * nTime);
+  double logLik;
+
+  int status = ghKalmanFilter(
+      nTime, d, dObs, &y[0], &m0[0], &P0[0], &Q[0], &R[0],
+      as<vector<double> >(xR), as<vector<double> >(wR), &callRMap,
+      &transition, &callRMap, &measurement, &mPred[0], &PPred[0], &mFilt[0],
+      &PFilt[0], &logLik);
+  if (status) {
+    stop("covariance matrix not positive definite at time " +
+         std::to_string(status));
+  }
+
+  return List::create(Named("mPred") = mPred, Named("PPred") = PPred,
+                      Named("mFilt") = mFilt, Named("PFilt") = PFilt,
+                      Named("logLik") = logLik);
+  END_RCPP
+}
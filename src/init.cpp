@@ -9,6 +9,10 @@ extern "C" {
                         (DL_FUNC) &gaussHermiteDataDirect);
     R_RegisterCCallable("fastGHQuad", "gaussHermiteDataGolubWelsch",
                         (DL_FUNC) &gaussHermiteDataGolubWelsch);
+    R_RegisterCCallable("fastGHQuad", "ghKalmanFilter",
+                        (DL_FUNC) (ghKalmanFilterFun) &ghKalmanFilter);
+    R_RegisterCCallable("fastGHQuad", "registerGhqFamily",
+                        (DL_FUNC) &registerGhqFamily);
   }
   
 }
@@ -1,4 +1,5 @@
 #include "lib.h"
+#include <float.h>
 
 using std::vector;
 using std::abs;
@@ -76,7 +77,7 @@ void quadInfoGolubWelsch(int n, vector<double> &D, vector<double> &E,
   // Setup for eigenvalue computations
   char JOBZ = 'V';  // Flag to compute both eigenvalues & vectors.
   int INFO;
-  vector<double> WORK(2 * n - 2);
+  vector<double> WORK(std::max(1, 2 * n - 2));
   vector<double> Z(n * n);  // This holds the resulting eigenvectors.
 
   // Run eigen decomposition
@@ -309,6 +310,71 @@ SEXP evalHermitePoly(SEXP xR, SEXP nR) {
   }
 }
 
+double hermiteNewtonStep(int n, double x, double *logAbsHnm1) {
+  //
+  // Evaluate the orthonormal Hermite polynomials h_n & h_n-1 at x via the
+  // recurrence of hermiteOrthoPolys and return the Newton step
+  //      h_n(x) / h_n'(x),   h_n'(x) = sqrt(2n) h_n-1(x)
+  //
+  // If logAbsHnm1 is not NULL, log|h_n-1(x)| is stored there. The
+  // recurrence is renormalized as it grows, so nothing overflows for any
+  // x & n.
+  //
+  const double big = 1e150, logBig = log(big);
+  double scale = -0.25 * log(M_PI);
+  double hkm1 = 0., hk = 1., hkp1;
+  for (int k = 0; k < n; k++) {
+    hkp1 = sqrt(2. / (k + 1.)) * x * hk - sqrt(k / (k + 1.)) * hkm1;
+    hkm1 = hk;
+    hk = hkp1;
+    if (fabs(hk) > big) {
+      hk /= big;
+      hkm1 /= big;
+      scale += logBig;
+    }
+  }
+
+  if (logAbsHnm1 != NULL) {
+    *logAbsHnm1 = log(fabs(hkm1)) + scale;
+  }
+  return hk / (sqrt(2. * n) * hkm1);
+}
+
+void polishHermiteRule(int n, vector<double> *x, vector<double> *w,
+                       vector<double> *logW) {
+  //
+  // Refine the nodes of a Gauss-Hermite rule of order n by Newton iteration
+  // on h_n, starting from the given x, then recompute the weights from the
+  // derivative:
+  //      w_i = 1 / (n h_n-1(x_i)^2)
+  // (Christoffel-Darboux at the roots of h_n).
+  //
+  // Need x & w of size n; if logW is not NULL, the log-weights are also
+  // stored there, since the weights themselves underflow for n above ~700.
+  //
+  // Eigenvalues from dstev have absolute error ~ eps sqrt(n), so the nodes
+  // near 0 & the weights in the tails lose relative accuracy as n grows;
+  // a few Newton steps restore both to full double precision at O(n^2)
+  // cost.
+  //
+  const int maxIter = 10;
+  int i, iter;
+  double step, logAbsHnm1 = 0., logN = log((double)n);
+  for (i = 0; i < n; i++) {
+    for (iter = 0; iter < maxIter; iter++) {
+      step = hermiteNewtonStep(n, (*x)[i], &logAbsHnm1);
+      (*x)[i] -= step;
+      if (!(fabs(step) > 2. * DBL_EPSILON * fabs((*x)[i]))) break;
+    }
+
+    double lw = -logN - 2. * logAbsHnm1;
+    (*w)[i] = exp(lw);
+    if (logW != NULL) {
+      (*logW)[i] = lw;
+    }
+  }
+}
+
 int gaussHermiteDataDirect(int n, vector<double> *x, vector<double> *w) {
   //
   // Calculates roots & weights of Hermite polynomials of order n for
@@ -319,7 +385,8 @@ int gaussHermiteDataDirect(int n, vector<double> *x, vector<double> *w) {
   // Using standard formulation (no generalizations or polynomial adjustment)
   //
   // Direct evaluation and root-finding; clear, but numerically unstable
-  // for n>20 or so
+  // for n>20 or so. The roots are polished by Newton iteration, which only
+  // helps while they are still near the true nodes.
   //
   // Calculate coefficients of Hermite polynomial of given order
   vector<double> coef(n + 1);
@@ -329,15 +396,8 @@ int gaussHermiteDataDirect(int n, vector<double> *x, vector<double> *w) {
   // which the integrand will be evaluated (x)
   findPolyRoots(coef, n, x);
 
-  // Calculate weights w
-  int i;
-  double log2 = log(2.0), logsqrtpi = 0.5 * log(M_PI);
-  for (i = 0; i < n; i++) {
-    // First, compute the log-weight
-    (*w)[i] = (n - 1.) * log2 + lgamma(n + 1) + logsqrtpi -
-              2. * log((double)n) - 2. * log(abs(hermitePoly((*x)[i], n - 1)));
-    (*w)[i] = exp((*w)[i]);
-  }
+  // Polish roots & calculate weights w
+  polishHermiteRule(n, x, w, NULL);
 
   return 0;
 }
@@ -350,7 +410,9 @@ int gaussHermiteDataGolubWelsch(int n, vector<double> *x, vector<double> *w) {
   //
   // Using standard formulation (no generalizations or polynomial adjustment)
   //
-  // Evaluations use Golub-Welsch algorithm; numerically stable for n>=100
+  // Evaluations use Golub-Welsch algorithm; numerically stable for n>=100.
+  // Nodes & weights are then polished to full precision by Newton
+  // iteration (see polishHermiteRule).
   //
   // Build Jacobi-similar symmetric tridiagonal matrix via diagonal &
   // sub-diagonal
@@ -360,15 +422,182 @@ int gaussHermiteDataGolubWelsch(int n, vector<double> *x, vector<double> *w) {
   // Get nodes & weights
   double mu0 = sqrt(M_PI);
   quadInfoGolubWelsch(n, D, E, mu0, x, w);
+  polishHermiteRule(n, x, w, NULL);
+
+  return 0;
+}
+
+void buildLegendreJacobi(int n, vector<double> *D, vector<double> *E) {
+  //
+  // Construct symmetric tridiagonal Jacobi matrix for the Legendre
+  // polynomials on [-1, 1], from their recurrence relation:
+  //      J_i,i = 0
+  //      J_i,i-1 = J_i-1,i = i / sqrt(4 i^2 - 1), i = 1, ..., n-1
+  //
+  // Need D of size n, E of size n-1
+  //
+  int i;
+  for (i = 0; i < n; i++) {
+    (*D)[i] = 0.;
+  }
+  for (i = 0; i < n - 1; i++) {
+    (*E)[i] = (i + 1.) / sqrt(4. * (i + 1.) * (i + 1.) - 1.);
+  }
+}
+
+void buildLaguerreJacobi(int n, double alpha, vector<double> *D,
+                         vector<double> *E) {
+  //
+  // Construct symmetric tridiagonal Jacobi matrix for the generalized
+  // Laguerre polynomials, orthogonal for t^alpha exp(-t) on [0, Inf):
+  //      J_i,i = 2 i + alpha + 1, i = 0, ..., n-1
+  //      J_i,i-1 = J_i-1,i = sqrt(i (i + alpha)), i = 1, ..., n-1
+  //
+  // Need D of size n, E of size n-1
+  //
+  int i;
+  for (i = 0; i < n; i++) {
+    (*D)[i] = 2. * i + alpha + 1.;
+  }
+  for (i = 0; i < n - 1; i++) {
+    (*E)[i] = sqrt((i + 1.) * (i + 1. + alpha));
+  }
+}
+
+int gaussHermiteHalfData(int n, vector<double> *x, vector<double> *w) {
+  //
+  // Calculates nodes & weights for half-range Gauss-Hermite integration of
+  // order n, i.e. for
+  //      \int_0^\infty f(x) exp(-x^2) dx
+  //
+  // Need x & w of size n
+  //
+  // The half-range Hermite polynomials have no closed-form recurrence, so
+  // their coefficients are computed by the discretized Stieltjes procedure
+  // (Gautschi, 1968): the weight exp(-x^2) on [0, L] is replaced by a
+  // composite Gauss-Legendre rule (nodes from Golub-Welsch) with M points,
+  // and the recurrence
+  //      b_k+1 q_k+1(t) = (t - a_k) q_k(t) - b_k q_k-1(t)
+  //      a_k = sum_m t_m q_k(t_m)^2 omega_m
+  // is run on orthonormal vectors over the discrete measure. L is chosen so
+  // that x^(2n) exp(-x^2) is negligible beyond it, and the panels are fine
+  // enough (with M >= 4n) that the discrete inner products are accurate for
+  // all degrees involved.
+  //
+  // The resulting Jacobi matrix is passed to Golub-Welsch with
+  // mu0 = sqrt(pi) / 2.
+  //
+  int i, k, m;
+
+  // Truncation point
+  double L = 26.;
+  for (i = 0; i < 5; i++) {
+    L = std::max(26., sqrt(2. * n * log(L) + 50.));
+  }
+
+  // Panels for composite Gauss-Legendre discretization: width 1/2 on
+  // [1/2, L], graded geometrically towards 0 on [0, 1/2], where the nodes of
+  // high-order rules cluster (roughly as 1 / n^2)
+  int nUniform = (int)ceil(2. * L) - 1;
+  int nGraded = 2 * (int)ceil(log((double)n + 1.) / M_LN2) + 1;
+  int nPanel = nUniform + nGraded;
+
+  // Points per panel: q_k^2 oscillates with frequency ~ 2 sqrt(2k), so the
+  // panel rules need q - 20 ~ sqrt(2n) / 2 points to resolve it
+  int q = std::max(20 + 2 * (int)ceil(0.5 * sqrt(2. * n)),
+                   (4 * n) / nPanel + 1);
+  vector<double> edges(nPanel + 1);
+  edges[0] = 0.;
+  for (i = 1; i <= nGraded; i++) {
+    edges[i] = 0.5 * ldexp(1., i - nGraded);
+  }
+  for (i = 1; i <= nUniform; i++) {
+    edges[nGraded + i] = 0.5 + (L - 0.5) * i / nUniform;
+  }
+
+  vector<double> D(q), E(q), xl(q), wl(q);
+  buildLegendreJacobi(q, &D, &E);
+  quadInfoGolubWelsch(q, D, E, 2., &xl, &wl);
+
+  int M = nPanel * q;
+  // Points t_m & Gauss-Legendre weights; the factor exp(-t_m^2) of omega_m
+  // is carried separately, in log scale
+  vector<double> t(M), sqrtLegW(M);
+  for (i = 0; i < nPanel; i++) {
+    double h = edges[i + 1] - edges[i];
+    for (m = 0; m < q; m++) {
+      t[i * q + m] = edges[i] + 0.5 * h * (xl[m] + 1.);
+      sqrtLegW[i * q + m] = sqrt(0.5 * h * wl[m]);
+    }
+  }
+
+  // Stieltjes procedure on v_k(t_m) = q_k(t_m) sqrt(omega_m), stored as
+  // vCur[m] exp(logScale[m]). exp(-t^2/2) underflows well inside [0, L]
+  // for large n, so each point is renormalized as q_k grows, as in
+  // hermiteOrthoPolys; factor[m] = exp(2 logScale[m]) enters the inner
+  // products.
+  const double big = 1e150, logBig = log(big);
+  vector<double> vPrev(M, 0.), vCur(sqrtLegW), logScale(M), factor(M);
+  double norm = 0.;
+  for (m = 0; m < M; m++) {
+    logScale[m] = -0.5 * t[m] * t[m];
+    factor[m] = exp(2. * logScale[m]);
+    norm += vCur[m] * vCur[m] * factor[m];
+  }
+  norm = sqrt(norm);
+  for (m = 0; m < M; m++) {
+    vCur[m] /= norm;
+  }
+
+  vector<double> alpha(n), beta(n);
+  double b = 0., vNext;
+  for (k = 0; k < n; k++) {
+    alpha[k] = 0.;
+    for (m = 0; m < M; m++) {
+      alpha[k] += t[m] * vCur[m] * vCur[m] * factor[m];
+    }
+    norm = 0.;
+    for (m = 0; m < M; m++) {
+      vNext = (t[m] - alpha[k]) * vCur[m] - b * vPrev[m];
+      vPrev[m] = vCur[m];
+      vCur[m] = vNext;
+      norm += vNext * vNext * factor[m];
+    }
+    b = sqrt(norm);
+    beta[k] = b;
+    for (m = 0; m < M; m++) {
+      vCur[m] /= b;
+      if (fabs(vCur[m]) > big) {
+        vCur[m] /= big;
+        vPrev[m] /= big;
+        logScale[m] += logBig;
+        factor[m] = exp(2. * logScale[m]);
+      }
+    }
+  }
+
+  // Get nodes & weights
+  D.assign(alpha.begin(), alpha.end());
+  E.assign(beta.begin(), beta.end());
+  double mu0 = 0.5 * sqrt(M_PI);
+  quadInfoGolubWelsch(n, D, E, mu0, x, w);
 
   return 0;
 }
 
-SEXP gaussHermiteData(SEXP nR) {
+SEXP gaussHermiteData(SEXP nR, SEXP threadsR) {
   using namespace Rcpp;
 
-  // Convert nR to int
+  // Convert nR & threadsR to int
   int n = IntegerVector(nR)[0];
+  int nThreads = IntegerVector(threadsR)[0];
+
+  // Large orders are built in place by the asymptotic Newton engine
+  if (n >= GH_ASYMPTOTIC_MIN_ORDER) {
+    NumericVector x(n), w(n);
+    gaussHermiteDataAsymptotic(n, &x[0], &w[0], NULL, nThreads);
+    return List::create(Named("x") = x, Named("w") = w);
+  }
 
   // Allocate vectors for x & w
   vector<double> x(n), w(n);
@@ -379,3 +608,87 @@ SEXP gaussHermiteData(SEXP nR) {
   // Build list for values
   return List::create(Named("x") = x, Named("w") = w);
 }
+
+int foldSymmetricRule(const vector<double> &x, const vector<double> &w,
+                      vector<double> *xHalf, vector<double> *wHalf) {
+  //
+  // Fold a symmetric quadrature rule onto its non-negative half for
+  // integrands with f(x) = f(-x) (or for f(x) + f(-x) supplied directly).
+  //
+  // Keeps the positive nodes with doubled weights; for odd n, the central
+  // node (smallest |x|) is kept at exactly zero with its original weight.
+  //
+  // On exit, xHalf & wHalf contain the (n+1)/2 folded nodes & weights, in
+  // the same relative order as the input. Returns the index of the central
+  // node, or -1 if n is even.
+  //
+  int n = x.size(), i, centre = -1;
+  if (n % 2 == 1) {
+    centre = 0;
+    for (i = 1; i < n; i++) {
+      if (abs(x[i]) < abs(x[centre])) centre = i;
+    }
+  }
+
+  xHalf->clear();
+  wHalf->clear();
+  for (i = 0; i < n; i++) {
+    if (i == centre) {
+      xHalf->push_back(0.);
+      wHalf->push_back(w[i]);
+    } else if (x[i] > 0.) {
+      xHalf->push_back(x[i]);
+      wHalf->push_back(2. * w[i]);
+    }
+  }
+
+  return centre;
+}
+
+SEXP foldSymmetricRule(SEXP xR, SEXP wR) {
+  using namespace Rcpp;
+
+  // Fold rule
+  vector<double> xHalf, wHalf;
+  foldSymmetricRule(as<vector<double> >(xR), as<vector<double> >(wR), &xHalf,
+                    &wHalf);
+
+  // Build list for values
+  return List::create(Named("x") = xHalf, Named("w") = wHalf);
+}
+
+SEXP validateHermiteRule(SEXP xR, SEXP wR) {
+  using namespace Rcpp;
+
+  // Convert to Rcpp objects
+  NumericVector x(xR), w(wR);
+  int n = x.size();
+
+  // Check on log-weights; zero (underflowed) weights contribute nothing
+  vector<double> logW(n);
+  for (int i = 0; i < n; i++) {
+    logW[i] = log(w[i]);
+  }
+  int worstDeg;
+  NumericVector maxDev(1);
+  maxDev[0] = validateHermiteRule(n, &x[0], &logW[0], 2 * n, &worstDeg);
+  maxDev.attr("degree") = worstDeg;
+
+  return maxDev;
+}
+
+SEXP gaussHermiteHalfData(SEXP nR) {
+  using namespace Rcpp;
+
+  // Convert nR to int
+  int n = IntegerVector(nR)[0];
+
+  // Fetch half-range rule from cache
+  const GHRule &rule = cachedHalfHermiteRule(n);
+
+  // Build list for values
+  return List::create(Named("x") = NumericVector(rule.x.begin(),
+                                                 rule.x.begin() + n),
+                      Named("w") = NumericVector(rule.w.begin(),
+                                                 rule.w.begin() + n));
+}
@@ -31,14 +31,293 @@ RcppExport SEXP findPolyRoots(SEXP cR);
 void hermitePolyCoef(int n, std::vector<double>* c);
 RcppExport SEXP hermitePolyCoef(SEXP nR);
 
-void buildHermiteJacobi(int n, std::vector<double>* D, std::vector<double> E);
+void buildHermiteJacobi(int n, std::vector<double>* D, std::vector<double>* E);
+void buildLegendreJacobi(int n, std::vector<double>* D, std::vector<double>* E);
+void buildLaguerreJacobi(int n, double alpha, std::vector<double>* D,
+                         std::vector<double>* E);
 void quadInfoGolubWelsch(int n, std::vector<double>& D, std::vector<double>& E,
-                         double mu0, std::vector<double>& x,
-                         std::vector<double>& w);
+                         double mu0, std::vector<double>* x,
+                         std::vector<double>* w);
+
+double hermiteNewtonStep(int n, double x, double* logAbsHnm1);
+void polishHermiteRule(int n, std::vector<double>* x, std::vector<double>* w,
+                       std::vector<double>* logW);
 
 int gaussHermiteDataDirect(int n, std::vector<double>* x,
                            std::vector<double>* w);
 int gaussHermiteDataGolubWelsch(int n, std::vector<double>* x, std::vector<double>* w);
-RcppExport SEXP gaussHermiteData(SEXP nR);
+RcppExport SEXP gaussHermiteData(SEXP nR, SEXP threadsR);
+
+// Orders from which gaussHermiteData & the session cache use the
+// asymptotic Newton engine
+enum { GH_ASYMPTOTIC_MIN_ORDER = 1000 };
+int gaussHermiteDataAsymptotic(int n, double* x, double* w, double* logW,
+                               int nThreads);
+
+int gaussHermiteHalfData(int n, std::vector<double>* x, std::vector<double>* w);
+RcppExport SEXP gaussHermiteHalfData(SEXP nR);
+
+// Spherical-radial cubature for exp(-|x|^2) on R^d (cubature.cpp)
+int sphericalRadialRule(int d, int degree, std::vector<double>* x,
+                        std::vector<double>* w);
+RcppExport SEXP sphericalRadialRule(SEXP dR, SEXP degreeR);
+
+int foldSymmetricRule(const std::vector<double> &x,
+                      const std::vector<double> &w, std::vector<double> *xHalf,
+                      std::vector<double> *wHalf);
+RcppExport SEXP foldSymmetricRule(SEXP xR, SEXP wR);
+RcppExport SEXP validateHermiteRule(SEXP xR, SEXP wR);
+
+// Alignment of native rule storage (one cache line), & the number of
+// doubles it holds; rule arrays are padded to a multiple of GH_PAD
+enum { GH_ALIGN = 64, GH_PAD = GH_ALIGN / sizeof(double) };
+
+// Allocator returning GH_ALIGN-aligned blocks. The offset to the block from
+// malloc is kept in the byte just before the aligned pointer, so it needs
+// nothing beyond malloc/free.
+template <class T> struct AlignedAllocator {
+  typedef T value_type;
+  AlignedAllocator() {}
+  template <class U> AlignedAllocator(const AlignedAllocator<U> &) {}
+  T *allocate(std::size_t n) {
+    unsigned char *raw = (unsigned char *)malloc(n * sizeof(T) + GH_ALIGN);
+    if (raw == NULL) throw std::bad_alloc();
+    std::size_t offset = GH_ALIGN - ((std::size_t)raw % GH_ALIGN);
+    raw[offset - 1] = (unsigned char)offset;
+    return (T *)(raw + offset);
+  }
+  void deallocate(T *p, std::size_t) {
+    unsigned char *q = (unsigned char *)p;
+    free(q - q[-1]);
+  }
+};
+template <class T, class U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+  return true;
+}
+template <class T, class U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+  return false;
+}
+typedef std::vector<double, AlignedAllocator<double> > alignedVector;
+
+// Session cache of rules by order (rules.cpp). Each array holds nPad
+// entries, nPad the smallest multiple of GH_PAD >= n, so kernels can run
+// over whole SIMD vectors without remainder loops: lanes i >= n have x = 0
+// & zero weight (w = adaptW = 0, logW = logAdaptW = -Inf), so they add
+// nothing to a weighted sum or log-sum-exp. adaptW = w exp(x^2) (logAdaptW
+// its log) & sqrt2x = sqrt(2) x are the weights & nodes of adaptive
+// quadrature, mu + sqrt(2) sigma x.
+struct GHRule {
+  int n, nPad;
+  alignedVector x, w, logW, adaptW, logAdaptW, sqrt2x;
+};
+void packRule(const std::vector<double> &x, const std::vector<double> &w,
+              const std::vector<double> &logW, GHRule *rule);
+const GHRule &cachedGaussHermiteRule(int n);
+const GHRule &cachedHalfHermiteRule(int n);
+struct GHWeightOrder {
+  std::vector<int> perm;
+  std::vector<double> tailMass;
+};
+const GHWeightOrder &cachedWeightOrder(int n);
+const std::vector<double> &cachedHermiteTransform(int n);
+void hermiteOrthoPolys(double x, int nDeg, double logScale, double *out,
+                       int stride);
+double validateHermiteRule(int n, const double *x, const double *logW,
+                           int nDeg, int *worstDeg);
+const std::vector<double> &cachedHermiteBaryWeights(int n, int type);
+const std::vector<double> &cachedHermiteDiffMatrix(int n, int order);
+
+// Vectorized log-integrands for native adaptive quadrature. Each call
+// evaluates m points; unit & cluster hold 0-based indices of the integral
+// each point belongs to, and results go to out (length m). Block & grid
+// integrands receive their m points as an m x dim column-major matrix z.
+typedef void (*ghqNestedLogIntegrand)(int m, const int *unit, const double *u,
+                                      const double *v, double *out,
+                                      void *data);
+typedef void (*ghqLogDensity)(int m, const int *cluster, const double *u,
+                              double *out, void *data);
+typedef void (*ghqBlockLogIntegrand)(int block, int m, int dim,
+                                     const double *z, double *out,
+                                     void *data);
+typedef void (*ghqIntegrand)(int m, const double *z, double *out,
+                             void *data);
+typedef void (*ghqGridLogDensity)(int m, int dim, const int *cluster,
+                                  const double *z, double *out, void *data);
+
+double logSumExp(int n, const double *x);
+void aghqLogMoments(int n, const double *logTerm, const double *z, double mu,
+                    double *logSum, double *mean, double *var);
+
+int nestedAghQuad(int nClusters, int nUnits, const int *group,
+                  const std::vector<double> &xOuter,
+                  const std::vector<double> &wOuter,
+                  const std::vector<double> &xInner,
+                  const std::vector<double> &wInner,
+                  ghqNestedLogIntegrand logInner, void *innerData,
+                  ghqLogDensity logOuter, void *outerData, int nAdapt,
+                  double *mu, double *sigma, const double *muInner,
+                  const double *sigmaInner, double *logInt);
+RcppExport SEXP nestedAghQuad(SEXP logInnerR, SEXP logOuterR, SEXP groupR,
+                              SEXP xOuterR, SEXP wOuterR, SEXP xInnerR,
+                              SEXP wInnerR, SEXP muR, SEXP sigmaR,
+                              SEXP muInnerR, SEXP sigmaInnerR, SEXP nAdaptR);
+
+void hermiteGrid(int d, const std::vector<double> &x,
+                 const std::vector<double> &w, std::vector<double> *nodes,
+                 std::vector<double> *logW);
+int factorAghQuad(int d, int nBlocks, const int *block,
+                  const std::vector<std::vector<double> > &x,
+                  const std::vector<std::vector<double> > &w, const double *mu,
+                  const double *sigma, int symmetric, ghqBlockLogIntegrand logG,
+                  void *data, double *logInt);
+RcppExport SEXP factorAghQuad(SEXP logGR, SEXP blockR, SEXP xR, SEXP wR,
+                              SEXP muR, SEXP sigmaR, SEXP symmetricR);
+
+int gridAghQuad(int nClusters, int d, int n, const double *mu,
+                const double *sigma, int tilePoints, int tileClusters,
+                ghqGridLogDensity logG, void *data, double *logInt);
+int cubatureAghQuad(int nClusters, int d, int nPts, const double *x,
+                    const double *w, const double *mu, const double *sigma,
+                    int tilePoints, int tileClusters, ghqGridLogDensity logG,
+                    void *data, double *logInt);
+int qmcAghQuad(int nClusters, int d, int nPoints, int nShifts,
+               const double *shifts, const double *mu, const double *sigma,
+               int tilePoints, int tileClusters, ghqGridLogDensity logG,
+               void *data, double *logInt, double *stdErr);
+RcppExport SEXP qmcAghQuad(SEXP logGR, SEXP muR, SEXP sigmaR, SEXP nR,
+                           SEXP shiftsR, SEXP tilePointsR,
+                           SEXP tileClustersR);
+RcppExport SEXP gridAghQuad(SEXP logGR, SEXP muR, SEXP sigmaR, SEXP nR,
+                            SEXP xR, SEXP wR, SEXP tilePointsR,
+                            SEXP tileClustersR);
+
+int batchAghQuad(int nClusters, const double *mu, const double *sigma,
+                 const std::vector<int> &orders, double tol, int maxPoints,
+                 ghqLogDensity logG, void *data, double *logInt, int *order,
+                 double *postMean, double *postVar,
+                 std::vector<std::vector<double> > *postNodes,
+                 std::vector<std::vector<double> > *postWeights);
+RcppExport SEXP batchAghQuad(SEXP logGR, SEXP muR, SEXP sigmaR, SEXP ordersR,
+                             SEXP tolR, SEXP maxPointsR, SEXP momentsR,
+                             SEXP weightsR);
+
+void aghqNodes(int nClusters, int n, const double *mu, const double *sigma,
+               double *u);
+int cachedAghQuad(int nClusters, int n, int nBlocks, const double *partial,
+                  const double *mu, const double *sigma, double *logInt,
+                  double *postMean, double *postVar);
+RcppExport SEXP aghqNodes(SEXP muR, SEXP sigmaR, SEXP nR);
+RcppExport SEXP cachedAghQuad(SEXP partialR, SEXP muR, SEXP sigmaR, SEXP nR);
+
+int mixtureExpect(int K, const double *prob, const double *mean,
+                  const double *sd, int n, int merge, ghqIntegrand f,
+                  void *data, double *value, double *compValue, int *nEval);
+RcppExport SEXP mixtureExpect(SEXP fR, SEXP probR, SEXP meanR, SEXP sdR,
+                              SEXP nR, SEXP mergeR);
+
+int lazyAghQuad(int n, ghqIntegrand g, void *data, double mu, double sigma,
+                double bound, double tol, int chunk, double *value,
+                int *nEval, double *errBound);
+RcppExport SEXP lazyAghQuad(SEXP gR, SEXP nR, SEXP muR, SEXP sigmaR,
+                            SEXP boundR, SEXP tolR, SEXP chunkR);
+
+// Native GLMM families (family.cpp). A kernel writes to out[i] the
+// log-likelihood of row obs[i] of the nObs x yDim (column-major) response y
+// at linear predictor eta[i], i < m, given the family's nParam parameters,
+// including terms constant in eta, so that familyAghQuad returns marginal
+// log-likelihoods. Kernels may run on several threads & must not call into R.
+typedef void (*ghqFamilyLogLik)(int m, const double *eta, const int *obs,
+                                const double *y, int nObs,
+                                const double *param, double *out);
+struct GHQFamily {
+  std::string name;
+  int yDim, nParam;
+  ghqFamilyLogLik logLik;
+};
+int registerGhqFamily(const char *name, int yDim, int nParam,
+                      ghqFamilyLogLik logLik);
+const GHQFamily *findGhqFamily(const char *name);
+int familyAghQuad(const GHQFamily &family, int nClusters, const int *obsStart,
+                  const double *y, int nObs, const double *offset,
+                  const double *param, double tau, const double *mu,
+                  const double *sigma, const std::vector<int> &orders,
+                  double tol, int maxPoints, int nThreads, double *logInt,
+                  int *order, double *postMean, double *postVar);
+RcppExport SEXP familyAghQuad(SEXP familyR, SEXP yR, SEXP obsStartR,
+                              SEXP offsetR, SEXP paramR, SEXP tauR, SEXP muR,
+                              SEXP sigmaR, SEXP ordersR, SEXP tolR,
+                              SEXP maxPointsR, SEXP threadsR);
+int slopesAghQuad(const GHQFamily &family, int nClusters, int d,
+                  const int *obsStart, const int *obsIndex, const int *rowPtr,
+                  const int *colIdx, const double *zVal, const double *y,
+                  int nObs, const double *offset, const double *param,
+                  const double *G, int n, int nPts, const double *x,
+                  const double *w, const double *mu, const double *sigma,
+                  int nThreads, double *logInt);
+RcppExport SEXP slopesAghQuad(SEXP familyR, SEXP yR, SEXP obsStartR,
+                              SEXP obsIndexR, SEXP zPtrR, SEXP zIdxR,
+                              SEXP zValR, SEXP zByRowR, SEXP offsetR,
+                              SEXP paramR, SEXP GR, SEXP muR, SEXP sigmaR,
+                              SEXP nR, SEXP xR, SEXP wR, SEXP threadsR);
+RcppExport SEXP ghqFamilies();
+
+// Expectation-propagation tilted moments (ep.cpp)
+enum { EP_LOGIT = 0, EP_PROBIT = 1 };
+double epSiteLogLik(int link, double y, double t, double *d1, double *d2);
+int epTiltedMoments(int m, const double *mu, const double *sigma2,
+                    const double *y, int link, const std::vector<double> &x,
+                    const std::vector<double> &w, int nNewton, double *logZ,
+                    double *mean, double *var);
+RcppExport SEXP epTiltedMoments(SEXP muR, SEXP sigma2R, SEXP yR, SEXP linkR,
+                                SEXP xR, SEXP wR, SEXP nNewtonR);
+
+// Gauss-Hermite filtering (filter.cpp). A map evaluates a function at m
+// points x (m x dIn, column-major) for time index t, writing m x dOut to out.
+typedef void (*ghfMap)(int t, int m, int dIn, const double *x, int dOut,
+                       double *out, void *data);
+int ghKalmanFilter(int nTime, int dState, int dObs, const double *y,
+                   const double *m0, const double *P0, const double *Q,
+                   const double *R, const std::vector<double> &x,
+                   const std::vector<double> &w, ghfMap transition,
+                   void *fData, ghfMap measurement, void *hData,
+                   double *mPred, double *PPred, double *mFilt, double *PFilt,
+                   double *logLik);
+typedef int (*ghKalmanFilterFun)(int, int, int, const double *,
+                                 const double *, const double *,
+                                 const double *, const double *,
+                                 const std::vector<double> &,
+                                 const std::vector<double> &, ghfMap, void *,
+                                 ghfMap, void *, double *, double *, double *,
+                                 double *, double *);
+RcppExport SEXP ghKalmanFilter(SEXP yR, SEXP m0R, SEXP P0R, SEXP QR, SEXP RR,
+                               SEXP xR, SEXP wR, SEXP transitionR,
+                               SEXP measurementR);
+
+// Discrete Hermite transforms (transform.cpp)
+enum { HT_POLYNOMIAL = 0, HT_FUNCTION = 1 };
+void hermiteTransform(int n, int nCol, const double *in, int inverse,
+                      int type, double *out);
+RcppExport SEXP hermiteTransform(SEXP inR, SEXP inverseR, SEXP typeR);
+void hermiteSeriesExpect(int nCoef, int nCol, const double *coef, int m,
+                         const double *mu, const double *sigma,
+                         double center, double scale, double *out);
+RcppExport SEXP hermiteSeriesExpect(SEXP coefR, SEXP muR, SEXP sigmaR,
+                                    SEXP centerR, SEXP scaleR);
+
+// Fast approximate discrete Hermite transform (fasttransform.cpp)
+void fastHermiteTransform(int n, int nCol, const double *in, int inverse,
+                          int type, double tol, double *out,
+                          std::vector<double> *x, std::vector<double> *w);
+RcppExport SEXP fastHermiteTransform(SEXP inR, SEXP inverseR, SEXP typeR,
+                                     SEXP tolR);
+
+// Hermite spectral collocation (spectral.cpp)
+void hermiteInterpolate(int n, int nCol, const double *u, int m,
+                        const double *xOut, int type, double *out);
+RcppExport SEXP hermiteInterpolate(SEXP uR, SEXP xOutR, SEXP typeR);
+RcppExport SEXP hermiteBaryWeights(SEXP nR, SEXP typeR);
+RcppExport SEXP hermiteDiffMatrix(SEXP nR, SEXP orderR);
 
 #endif
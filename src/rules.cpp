@@ -0,0 +1,332 @@
+#include "lib.h"
+#include <algorithm>
+#include <map>
+
+using std::vector;
+
+namespace {
+
+// Rules & derived matrices, keyed by order. These persist for the life of
+// the session; they are filled on first use and never invalidated.
+std::map<int, GHRule> ruleCache, halfRuleCache;
+std::map<int, vector<double> > transformCache;
+std::map<int, vector<double> > baryPolyCache, baryFunctionCache;
+std::map<int, vector<double> > diff1Cache, diff2Cache;
+std::map<int, GHWeightOrder> orderCache;
+
+// Largest deviation from exactness (see validateHermiteRule) tolerated for
+// rules entering the cache without a warning
+const double VALIDATE_TOL = 1e-12;
+
+// Degrees checked when rules of order GH_ASYMPTOTIC_MIN_ORDER or more enter
+// the cache; the full check of all 2n degrees would cost far more than
+// building the rule
+const int VALIDATE_LARGE_DEGREES = 64;
+
+}  // namespace
+
+void packRule(const vector<double> &x, const vector<double> &w,
+              const vector<double> &logW, GHRule *rule) {
+  //
+  // Copy a rule of order n = x.size() into the aligned, padded layout of
+  // GHRule, filling the padding lanes with zero-weight nodes at 0 & adding
+  // the adaptive weights & scaled nodes.
+  //
+  int n = x.size(), nPad = (n + GH_PAD - 1) / GH_PAD * GH_PAD;
+  rule->n = n;
+  rule->nPad = nPad;
+  rule->x.assign(nPad, 0.);
+  rule->w.assign(nPad, 0.);
+  rule->logW.assign(nPad, -INFINITY);
+  rule->adaptW.assign(nPad, 0.);
+  rule->logAdaptW.assign(nPad, -INFINITY);
+  rule->sqrt2x.assign(nPad, 0.);
+  for (int i = 0; i < n; i++) {
+    rule->x[i] = x[i];
+    rule->w[i] = w[i];
+    rule->logW[i] = logW[i];
+    rule->logAdaptW[i] = logW[i] + x[i] * x[i];
+    rule->adaptW[i] = exp(rule->logAdaptW[i]);
+    rule->sqrt2x[i] = M_SQRT2 * x[i];
+  }
+}
+
+const GHRule &cachedGaussHermiteRule(int n) {
+  //
+  // Return the Gauss-Hermite rule of order n, computing it on first use.
+  //
+  std::map<int, GHRule>::iterator it = ruleCache.find(n);
+  if (it != ruleCache.end()) {
+    return it->second;
+  }
+
+  // Golub-Welsch, then Newton polishing, or the O(n^2) asymptotic Newton
+  // engine for large orders, where the eigenvectors cost O(n^3);
+  // log-weights are taken from the Newton step, so they stay finite where
+  // the weights underflow
+  GHRule &rule = ruleCache[n];
+  vector<double> x(n), w(n), logW(n);
+  if (n >= GH_ASYMPTOTIC_MIN_ORDER) {
+    gaussHermiteDataAsymptotic(n, &x[0], &w[0], &logW[0], 1);
+  } else {
+    vector<double> D(n), E(n);
+    buildHermiteJacobi(n, &D, &E);
+    quadInfoGolubWelsch(n, D, E, sqrt(M_PI), &x, &w);
+    polishHermiteRule(n, &x, &w, &logW);
+  }
+  packRule(x, w, logW, &rule);
+
+  // Check exactness before the rule is reused for the rest of the session:
+  // on all 2n degrees for small orders, & on the lowest degrees only for
+  // large ones, which keeps the check O(n) there
+  int worstDeg, nDeg = (n >= GH_ASYMPTOTIC_MIN_ORDER)
+                           ? std::min(2 * n, VALIDATE_LARGE_DEGREES)
+                           : 2 * n;
+  double maxDev =
+      validateHermiteRule(n, &rule.x[0], &rule.logW[0], nDeg, &worstDeg);
+  if (!(maxDev <= VALIDATE_TOL)) {
+    Rf_warning("Gauss-Hermite rule of order %d deviates from exactness by "
+               "%g at degree %d",
+               n, maxDev, worstDeg);
+  }
+  return rule;
+}
+
+namespace {
+
+// Orders node indices by decreasing weight, ties by index
+struct ByWeightDesc {
+  const double *w;
+  explicit ByWeightDesc(const double *w_) : w(w_) {}
+  bool operator()(int i, int j) const {
+    return (w[i] != w[j]) ? (w[i] > w[j]) : (i < j);
+  }
+};
+
+}  // namespace
+
+const GHWeightOrder &cachedWeightOrder(int n) {
+  //
+  // Return the nodes of the Gauss-Hermite rule of order n sorted by
+  // decreasing weight, with tail masses
+  //      tailMass[j] = sum_{i >= j} w[perm[i]],   j = 0, ..., n
+  // computing them on first use. tailMass[j] bounds the weight not yet
+  // used after evaluating the first j nodes in this order; it is summed
+  // from the smallest weights up, so it stays accurate far into the tail.
+  //
+  std::map<int, GHWeightOrder>::iterator it = orderCache.find(n);
+  if (it != orderCache.end()) {
+    return it->second;
+  }
+
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  GHWeightOrder &order = orderCache[n];
+  order.perm.resize(n);
+  for (int i = 0; i < n; i++) {
+    order.perm[i] = i;
+  }
+  std::sort(order.perm.begin(), order.perm.end(), ByWeightDesc(&rule.w[0]));
+
+  order.tailMass.assign(n + 1, 0.);
+  for (int j = n - 1; j >= 0; j--) {
+    order.tailMass[j] = order.tailMass[j + 1] + rule.w[order.perm[j]];
+  }
+  return order;
+}
+
+const GHRule &cachedHalfHermiteRule(int n) {
+  //
+  // Return the half-range Gauss-Hermite rule of order n (on [0, Inf)),
+  // computing it on first use.
+  //
+  std::map<int, GHRule>::iterator it = halfRuleCache.find(n);
+  if (it != halfRuleCache.end()) {
+    return it->second;
+  }
+
+  GHRule &rule = halfRuleCache[n];
+  vector<double> x(n), w(n), logW(n);
+  gaussHermiteHalfData(n, &x, &w);
+  for (int i = 0; i < n; i++) {
+    logW[i] = log(w[i]);
+  }
+  packRule(x, w, logW, &rule);
+  return rule;
+}
+
+void hermiteOrthoPolys(double x, int nDeg, double logScale, double *out,
+                       int stride) {
+  //
+  // Evaluate the orthonormal Hermite polynomials
+  //      h_k(x) = H_k(x) / sqrt(2^k k! sqrt(pi)),   k = 0, ..., nDeg - 1
+  // scaled by exp(logScale), via the stable three-term recurrence
+  //      h_k+1(x) = sqrt(2 / (k+1)) x h_k(x) - sqrt(k / (k+1)) h_k-1(x)
+  //
+  // On exit, out[k * stride] contains exp(logScale) * h_k(x).
+  //
+  // The scale is carried separately and the recurrence is renormalized as
+  // it grows, so that e.g. logScale = -x^2/2 gives the orthonormal Hermite
+  // functions without underflow far into the tails; terms are flushed to
+  // zero only where the scaled value itself underflows.
+  //
+  const double big = 1e150, logBig = log(big);
+  double scale = logScale - 0.25 * log(M_PI);
+  double factor = exp(scale);
+  double hkm1 = 0., hk = 1., hkp1;
+
+  for (int k = 0; k < nDeg; k++) {
+    out[k * stride] = hk * factor;
+
+    hkp1 = sqrt(2. / (k + 1.)) * x * hk - sqrt(k / (k + 1.)) * hkm1;
+    hkm1 = hk;
+    hk = hkp1;
+    if (fabs(hk) > big) {
+      hk /= big;
+      hkm1 /= big;
+      scale += logBig;
+      factor = exp(scale);
+    }
+  }
+}
+
+double validateHermiteRule(int n, const double *x, const double *logW,
+                           int nDeg, int *worstDeg) {
+  //
+  // Check the exactness of a Gauss-Hermite rule of order n (nodes x,
+  // log-weights logW) on the orthonormal Hermite polynomials h_k, k = 0,
+  // ..., nDeg - 1; with nDeg = 2n, these span all polynomials of degree up
+  // to 2n - 1. Each
+  //      d_k = pi^(-1/4) sum_i w_i h_k(x_i) - delta_k0
+  // vanishes for an exact rule; returns max_k |d_k|, & stores the k
+  // attaining it in worstDeg if not NULL.
+  //
+  // The weights are folded into the scale of hermiteOrthoPolys, so the
+  // terms stay O(1) & nothing overflows, unlike monomial moments. The cost
+  // is O(n nDeg), so a full check is O(n^2) with a larger constant than
+  // building the rule itself.
+  //
+  int i, k;
+  vector<double> d(nDeg, 0.), h(nDeg);
+  for (i = 0; i < n; i++) {
+    hermiteOrthoPolys(x[i], nDeg, logW[i] - 0.25 * log(M_PI), &h[0], 1);
+    for (k = 0; k < nDeg; k++) {
+      d[k] += h[k];
+    }
+  }
+  d[0] -= 1.;
+
+  double maxDev = 0.;
+  int worst = 0;
+  for (k = 0; k < nDeg; k++) {
+    if (!(fabs(d[k]) <= maxDev)) {
+      maxDev = fabs(d[k]);
+      worst = k;
+    }
+  }
+  if (worstDeg != NULL) {
+    *worstDeg = worst;
+  }
+  return maxDev;
+}
+
+const vector<double> &cachedHermiteTransform(int n) {
+  //
+  // Return the n x n (column-major) discrete Hermite transform matrix
+  //      Q_ki = h_k(x_i) sqrt(w_i)
+  // for the Gauss-Hermite rule of order n, computing it on first use.
+  //
+  // Q is orthogonal (Q Q' = I, by the exactness of the rule for polynomials
+  // of degree up to 2n - 1), so it is also the inverse transform.
+  //
+  std::map<int, vector<double> >::iterator it = transformCache.find(n);
+  if (it != transformCache.end()) {
+    return it->second;
+  }
+
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  vector<double> &Q = transformCache[n];
+  Q.resize(n * n);
+  for (int i = 0; i < n; i++) {
+    hermiteOrthoPolys(rule.x[i], n, 0.5 * rule.logW[i], &Q[i * n], 1);
+  }
+  return Q;
+}
+
+const vector<double> &cachedHermiteBaryWeights(int n, int type) {
+  //
+  // Return barycentric weights for interpolation through the Gauss-Hermite
+  // nodes of order n, computing them on first use.
+  //
+  // For polynomial interpolation, lambda_j = 1 / prod_{k != j}(x_j - x_k) is
+  // proportional to 1 / H_n'(x_j), i.e. to (-1)^j sqrt(w_j); for the
+  // Hermite function interpolant u(x) = exp(-x^2/2) p(x), the weights
+  // lambda_j exp(x_j^2/2) are proportional to (-1)^j sqrt(w_j) exp(x_j^2/2),
+  // which stay O(1) across all nodes. Both are formed from the cached
+  // log-weights and scaled to a maximum magnitude of 1.
+  //
+  std::map<int, vector<double> > &cache =
+      (type == HT_FUNCTION) ? baryFunctionCache : baryPolyCache;
+  std::map<int, vector<double> >::iterator it = cache.find(n);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  vector<double> &v = cache[n];
+  vector<double> logV(n);
+  int j;
+  double maxLogV = -INFINITY;
+  for (j = 0; j < n; j++) {
+    logV[j] = 0.5 * rule.logW[j];
+    if (type == HT_FUNCTION) logV[j] += 0.5 * rule.x[j] * rule.x[j];
+    maxLogV = std::max(maxLogV, logV[j]);
+  }
+  v.resize(n);
+  for (j = 0; j < n; j++) {
+    v[j] = ((j % 2) ? -1. : 1.) * exp(logV[j] - maxLogV);
+  }
+  return v;
+}
+
+const vector<double> &cachedHermiteDiffMatrix(int n, int order) {
+  //
+  // Return the n x n (column-major) Hermite function differentiation matrix
+  // of the given order (1 or 2) at the Gauss-Hermite nodes of order n,
+  // computing both on first use. Applied to values u(x_i) of
+  // u(x) = exp(-x^2/2) p(x), p a polynomial of degree < n, they give u' &
+  // u'' at the nodes, as in herdif of Weideman & Reddy (2000).
+  //
+  // With v the Hermite function barycentric weights,
+  //      D1_ij = (v_j / v_i) / (x_i - x_j),   D1_ii = 0
+  //      D2_ij = -2 D1_ij / (x_i - x_j),      D2_ii = -1 - sum_{k != i}
+  //                                                   1 / (x_i - x_k)^2
+  // for i != j. The diagonals use sum_{k != i} 1 / (x_i - x_k) = x_i at the
+  // zeros of H_n, from the Hermite differential equation.
+  //
+  std::map<int, vector<double> > &cache =
+      (order == 2) ? diff2Cache : diff1Cache;
+  std::map<int, vector<double> >::iterator it = cache.find(n);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  const vector<double> &v = cachedHermiteBaryWeights(n, HT_FUNCTION);
+  const double *x = &rule.x[0];
+  vector<double> &D1 = diff1Cache[n], &D2 = diff2Cache[n];
+  D1.assign(n * n, 0.);
+  D2.assign(n * n, 0.);
+  int i, j;
+  for (i = 0; i < n; i++) {
+    double s2 = 0.;
+    for (j = 0; j < n; j++) {
+      if (j == i) continue;
+      double r = 1. / (x[i] - x[j]);
+      D1[i + j * n] = v[j] / v[i] * r;
+      D2[i + j * n] = -2. * D1[i + j * n] * r;
+      s2 += r * r;
+    }
+    D2[i + i * n] = -1. - s2;
+  }
+  return (order == 2) ? D2 : D1;
+}
@@ -0,0 +1,111 @@
+#include "lib.h"
+
+using std::vector;
+
+void hermiteInterpolate(int n, int nCol, const double *u, int m,
+                        const double *xOut, int type, double *out) {
+  //
+  // Barycentric interpolation from values at the n Gauss-Hermite nodes to m
+  // arbitrary points, for nCol columns (n x nCol, column-major) at once. On
+  // exit, out (m x nCol) contains the interpolant at xOut.
+  //
+  // For type HT_POLYNOMIAL, the interpolant is the polynomial of degree < n
+  // through the values; for HT_FUNCTION, it is the Hermite function
+  // exp(-x^2/2) p(x), p of degree < n, as used for collocation with the
+  // differentiation matrices. Both use the second (true) barycentric form
+  //
+  //      p(t) = sum_j v_j u_j / (t - x_j) / sum_j lambda_j / (t - x_j)
+  //
+  // with the cached weights, so each point costs O(n) per column. For
+  // HT_FUNCTION, v_j = lambda_j exp(x_j^2/2) and the factor exp(-t^2/2) is
+  // applied to the ratio, which keeps all terms in range far into the
+  // tails.
+  //
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  const vector<double> &lambda = cachedHermiteBaryWeights(n, HT_POLYNOMIAL);
+  const vector<double> &v = cachedHermiteBaryWeights(n, type);
+  int i, j, c;
+
+  // Log of the relative scale of v & lambda, from their normalizations
+  double logScale = 0.;
+  if (type == HT_FUNCTION) {
+    double maxP = -INFINITY, maxF = -INFINITY;
+    for (j = 0; j < n; j++) {
+      maxP = std::max(maxP, 0.5 * rule.logW[j]);
+      maxF = std::max(maxF, 0.5 * rule.logW[j] + 0.5 * rule.x[j] * rule.x[j]);
+    }
+    logScale = maxF - maxP;
+  }
+
+  vector<double> num(nCol);
+  for (i = 0; i < m; i++) {
+    double t = xOut[i], den = 0.;
+    int hit = -1;
+    std::fill(num.begin(), num.end(), 0.);
+    for (j = 0; j < n; j++) {
+      double diff = t - rule.x[j];
+      if (diff == 0.) {
+        hit = j;
+        break;
+      }
+      double r = 1. / diff;
+      den += lambda[j] * r;
+      for (c = 0; c < nCol; c++) {
+        num[c] += v[j] * r * u[j + c * n];
+      }
+    }
+
+    if (hit >= 0) {
+      for (c = 0; c < nCol; c++) {
+        out[i + c * m] = u[hit + c * n];
+      }
+      continue;
+    }
+    double factor = 1. / den;
+    if (type == HT_FUNCTION) factor *= exp(logScale - 0.5 * t * t);
+    for (c = 0; c < nCol; c++) {
+      out[i + c * m] = num[c] * factor;
+    }
+  }
+}
+
+SEXP hermiteInterpolate(SEXP uR, SEXP xOutR, SEXP typeR) {
+  using namespace Rcpp;
+
+  // Convert to Rcpp objects
+  NumericMatrix u(uR);
+  NumericVector xOut(xOutR);
+  int n = u.nrow(), nCol = u.ncol(), m = xOut.size();
+  int type = IntegerVector(typeR)[0];
+
+  // Allocate matrix for results
+  NumericMatrix out(m, nCol);
+
+  // Interpolate
+  hermiteInterpolate(n, nCol, &u[0], m, &xOut[0], type, &out[0]);
+
+  return out;
+}
+
+SEXP hermiteBaryWeights(SEXP nR, SEXP typeR) {
+  using namespace Rcpp;
+
+  int n = IntegerVector(nR)[0];
+  int type = IntegerVector(typeR)[0];
+
+  return wrap(cachedHermiteBaryWeights(n, type));
+}
+
+SEXP hermiteDiffMatrix(SEXP nR, SEXP orderR) {
+  using namespace Rcpp;
+
+  int n = IntegerVector(nR)[0];
+  int order = IntegerVector(orderR)[0];
+  const vector<double> &D = cachedHermiteDiffMatrix(n, order);
+
+  // Copy cached matrix for return
+  NumericMatrix out(n, n);
+  std::copy(D.begin(), D.end(), out.begin());
+
+  return out;
+}
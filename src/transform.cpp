@@ -0,0 +1,146 @@
+#include "lib.h"
+#include <R_ext/BLAS.h>
+
+using std::vector;
+
+void hermiteTransform(int n, int nCol, const double *in, int inverse,
+                      int type, double *out) {
+  //
+  // Discrete Hermite transform between values at the n Gauss-Hermite nodes
+  // and coefficients of the first n normalized Hermite basis functions, for
+  // nCol columns (n x nCol, column-major) at once.
+  //
+  // For type HT_POLYNOMIAL, values are f(xi_i) at the standard normal nodes
+  // xi_i = sqrt(2) x_i and coefficients are those of the orthonormal
+  // probabilists' Hermite polynomials He_k(xi) / sqrt(k!), i.e. the
+  // polynomial chaos expansion of f.
+  //
+  // For type HT_FUNCTION, values are u(x_i) and coefficients are those of
+  // the orthonormal Hermite functions h_k(x) exp(-x^2/2).
+  //
+  // With the cached orthogonal matrix Q_ki = h_k(x_i) sqrt(w_i), both
+  // transforms are a diagonal scaling and one dgemm:
+  //      forward:  coef   = Q diag(s) values
+  //      inverse:  values = diag(1/s) Q' coef
+  // where s_i = sqrt(w_i / sqrt(pi)) (polynomial) or sqrt(w_i) exp(x_i^2/2)
+  // (function).
+  //
+  const GHRule &rule = cachedGaussHermiteRule(n);
+  const vector<double> &Q = cachedHermiteTransform(n);
+  int i, j;
+  char trans = inverse ? 'T' : 'N', notrans = 'N';
+  double one = 1., zero = 0.;
+
+  // Log of diagonal scaling
+  vector<double> logS(n);
+  for (i = 0; i < n; i++) {
+    logS[i] = 0.5 * rule.logW[i];
+    if (type == HT_POLYNOMIAL) {
+      logS[i] -= 0.25 * log(M_PI);
+    } else {
+      logS[i] += 0.5 * rule.x[i] * rule.x[i];
+    }
+  }
+
+  if (!inverse) {
+    vector<double> scaled(in, in + n * nCol);
+    for (j = 0; j < nCol; j++) {
+      for (i = 0; i < n; i++) {
+        scaled[i + j * n] *= exp(logS[i]);
+      }
+    }
+    F77_CALL(dgemm)(&trans, &notrans, &n, &nCol, &n, &one, &Q[0], &n,
+                    &scaled[0], &n, &zero, out, &n FCONE FCONE);
+  } else {
+    F77_CALL(dgemm)(&trans, &notrans, &n, &nCol, &n, &one, &Q[0], &n, in,
+                    &n, &zero, out, &n FCONE FCONE);
+    for (j = 0; j < nCol; j++) {
+      for (i = 0; i < n; i++) {
+        out[i + j * n] *= exp(-logS[i]);
+      }
+    }
+  }
+}
+
+SEXP hermiteTransform(SEXP inR, SEXP inverseR, SEXP typeR) {
+  using namespace Rcpp;
+
+  // Convert to Rcpp objects
+  NumericMatrix in(inR);
+  int n = in.nrow(), nCol = in.ncol();
+  int inverse = LogicalVector(inverseR)[0];
+  int type = IntegerVector(typeR)[0];
+
+  // Allocate matrix for results
+  NumericMatrix out(n, nCol);
+
+  // Run transform
+  hermiteTransform(n, nCol, &in[0], inverse, type, &out[0]);
+
+  return out;
+}
+
+void hermiteSeriesExpect(int nCoef, int nCol, const double *coef, int m,
+                         const double *mu, const double *sigma,
+                         double center, double scale, double *out) {
+  //
+  // Gaussian expectations E[f(mu_j + sigma_j Z)], Z ~ N(0, 1), for m pairs
+  // (mu_j, sigma_j) at once, from a Hermite series surrogate of f.
+  //
+  // coef (nCoef x nCol, column-major) holds polynomial chaos coefficients
+  // of g(xi) = f(center + scale * xi) for nCol outputs, as returned by
+  // hermiteTransform with type HT_POLYNOMIAL. With a = (mu - center) /
+  // scale & b = sigma / scale, the Gauss transform of He_k is closed form:
+  // m_k = E[He_k(a + b Z)] satisfies
+  //
+  //      m_k+1 = a m_k + k (b^2 - 1) m_k-1,   m_0 = 1, m_1 = a
+  //
+  // (from the generating function exp(t a + t^2 (b^2 - 1) / 2)), so each
+  // pair costs O(nCoef) per output instead of a quadrature over f. The
+  // recurrence is run for the normalized m_k / sqrt(k!), to match the
+  // coefficients and avoid overflow. On exit, out (m x nCol) contains the
+  // expectations.
+  //
+  int j, k, c;
+  double a, v, nkm1, nk, nkp1;
+  for (j = 0; j < m; j++) {
+    a = (mu[j] - center) / scale;
+    v = sigma[j] / scale;
+    v = v * v - 1.;
+
+    for (c = 0; c < nCol; c++) {
+      out[j + c * m] = coef[c * nCoef];
+    }
+    nkm1 = 0.;
+    nk = 1.;
+    for (k = 0; k + 1 < nCoef; k++) {
+      nkp1 = (a * nk + sqrt((double)k) * v * nkm1) / sqrt(k + 1.);
+      nkm1 = nk;
+      nk = nkp1;
+      for (c = 0; c < nCol; c++) {
+        out[j + c * m] += coef[k + 1 + c * nCoef] * nk;
+      }
+    }
+  }
+}
+
+SEXP hermiteSeriesExpect(SEXP coefR, SEXP muR, SEXP sigmaR, SEXP centerR,
+                         SEXP scaleR) {
+  using namespace Rcpp;
+
+  // Convert to Rcpp objects
+  NumericMatrix coef(coefR);
+  NumericVector mu(muR), sigma(sigmaR);
+  int nCoef = coef.nrow(), nCol = coef.ncol(), m = mu.size();
+  double center = NumericVector(centerR)[0];
+  double scale = NumericVector(scaleR)[0];
+
+  // Allocate matrix for results
+  NumericMatrix out(m, nCol);
+
+  // Evaluate expectations
+  hermiteSeriesExpect(nCoef, nCol, &coef[0], m, &mu[0], &sigma[0], center,
+                      scale, &out[0]);
+
+  return out;
+}